@@ -0,0 +1,97 @@
+/*
+ * bintrace.c - encode and decode ops in the compact binary trace format
+ *     described in bintrace.h
+ */
+#include <string.h>
+#include "bintrace.h"
+
+/*
+ * put_varint - store v in LEB128 form, 7 bits per byte
+ */
+static size_t put_varint(unsigned char *buf, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+/*
+ * get_varint - inverse of put_varint; NULL if the varint runs past end
+ */
+static const unsigned char *get_varint(const unsigned char *p,
+                                       const unsigned char *end, uint64_t *v)
+{
+    uint64_t result = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        unsigned char b = *p++;
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+/*
+ * bt_is_binary - Does buf start with a binary trace header?
+ */
+int bt_is_binary(const void *buf, size_t len)
+{
+    return len >= sizeof(bintrace_hdr_t) &&
+        memcmp(buf, BT_MAGIC, sizeof(((bintrace_hdr_t *)0)->magic)) == 0;
+}
+
+/*
+ * bt_encode_op - Index deltas are zigzag encoded so that the common
+ *     small backwards steps (and free(NULL), index -1) stay short.
+ */
+size_t bt_encode_op(unsigned char *buf, int type, int index, size_t size,
+                    int *prev_index)
+{
+    int64_t delta = (int64_t)index - *prev_index;
+    uint64_t zz = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    size_t n;
+
+    n = put_varint(buf, (zz << 2) | (uint64_t)type);
+    if (type != BT_FREE)
+        n += put_varint(buf + n, size);
+    *prev_index = index;
+    return n;
+}
+
+/*
+ * bt_decode_op - Decode the op at p, see bt_encode_op
+ */
+const unsigned char *bt_decode_op(const unsigned char *p,
+                                  const unsigned char *end,
+                                  int *type, int *index, size_t *size,
+                                  int *prev_index)
+{
+    uint64_t v, zz;
+    int64_t delta;
+
+    if ((p = get_varint(p, end, &v)) == NULL)
+        return NULL;
+    *type = (int)(v & 3);
+    zz = v >> 2;
+    delta = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+    *index = (int)(*prev_index + delta);
+    *prev_index = *index;
+
+    *size = 0;
+    if (*type != BT_FREE) {
+        if ((p = get_varint(p, end, &v)) == NULL)
+            return NULL;
+        *size = (size_t)v;
+    }
+    return p;
+}
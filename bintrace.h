@@ -0,0 +1,59 @@
+/*
+ * bintrace.h - compact binary trace format
+ *
+ * A binary trace is a fixed-size header followed by a packed stream of
+ * ops. Each op is a varint holding (zigzag(index - previous index) << 2
+ * | type), followed by a varint payload size for allocs and reallocs.
+ * The header carries the same four fields as a .rep header plus some
+ * stats precomputed by rep2bin, so the driver never has to scan the
+ * ops to learn them.
+ */
+#ifndef __BINTRACE_H_
+#define __BINTRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BT_MAGIC   "MMBTRACE"   /* first 8 bytes of every binary trace */
+#define BT_VERSION 1
+
+/* Op types, in the same order as traceop_t in mdriver.c */
+#define BT_ALLOC   0
+#define BT_FREE    1
+#define BT_REALLOC 2
+
+/* An encoded op is never longer than this */
+#define BT_MAX_OP_BYTES 15
+
+typedef struct {
+    char magic[8];               /* BT_MAGIC */
+    uint32_t version;            /* BT_VERSION */
+    uint32_t weight;             /* same meaning as in a .rep header */
+    uint32_t num_ids;
+    uint32_t num_ops;
+    uint32_t ignore_ranges;
+    uint32_t num_allocs;         /* op counts by type */
+    uint32_t num_reallocs;
+    uint32_t num_frees;
+    uint32_t max_size;           /* largest alloc/realloc request */
+    uint32_t peak_live_blocks;   /* most blocks allocated at once */
+    uint64_t peak_live_bytes;    /* high-water mark of live payload bytes */
+    uint64_t total_alloc_bytes;  /* sum of all alloc/realloc requests */
+    uint64_t ops_bytes;          /* length of the op stream that follows */
+} bintrace_hdr_t;
+
+/* Check that buf starts with a binary trace header */
+int bt_is_binary(const void *buf, size_t len);
+
+/* Encode one op at buf; return the number of bytes written */
+size_t bt_encode_op(unsigned char *buf, int type, int index, size_t size,
+                    int *prev_index);
+
+/* Decode one op at p; return a pointer just past it, or NULL if the
+   op runs past end */
+const unsigned char *bt_decode_op(const unsigned char *p,
+                                  const unsigned char *end,
+                                  int *type, int *index, size_t *size,
+                                  int *prev_index);
+
+#endif /* __BINTRACE_H_ */
@@ -10,9 +10,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -30,47 +35,129 @@
 
 /* $begin x86cyclecounter */
 /* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+static unsigned long long cyc_start = 0;
 
 
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
+   The read is serialized, see tsc_begin in clock.h. */
 void access_counter(unsigned *hi, unsigned *lo)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-        : "=r" (*hi), "=r" (*lo)                /* and move results to */
-        : /* No input */                        /* the two outputs */
-        : "%edx", "%eax");
+    unsigned long long cyc = tsc_begin();
+    *hi = (unsigned)(cyc >> 32);
+    *lo = (unsigned)cyc;
 }
 
-/* Record the current value of the cycle counter. */
+/* Record the current value of the cycle counter. Code before the call
+   retires before the counter is read. */
 void start_counter()
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    cyc_start = tsc_begin();
 }
 
-/* Return the number of cycles since the last call to start_counter. */
+/* Return the number of cycles since the last call to start_counter. 
+   The counter is read only after the timed code has retired. */
 double get_counter()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
+    return (double)(tsc_end() - cyc_start);
+}
+/* $end x86cyclecounter */
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
+/*
+ * tsc_invariant - Does the TSC tick at a constant rate, whatever the
+ *     core's frequency or sleep state? That is CPUID leaf 0x80000007,
+ *     EDX bit 8. Hypervisors often hide that leaf, so also accept the
+ *     kernel's constant_tsc and nonstop_tsc flags, which mean the same.
+ */
+static int tsc_invariant(void)
+{
+    unsigned a, b, c, d;
+    static char buf[4096];
+    int found = 0;
+    FILE *fp;
+
+    if (__get_cpuid(0x80000000, &a, &b, &c, &d) && a >= 0x80000007 &&
+        __get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1 << 8)))
+        return 1;
+
+    if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+        return 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (strncmp(buf, "flags", 5) == 0) {
+            found = strstr(buf, " constant_tsc") && strstr(buf, " nonstop_tsc");
+            break;
+        }
+    }
+    fclose(fp);
+    return found;
+}
 
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
+/* Nanoseconds on the raw monotonic clock, which NTP does not slew */
+static double raw_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * tsc_stamp - Read the TSC and the raw clock at (nearly) the same
+ *     instant: take the TSC read that sits in the narrowest clock
+ *     window out of a few tries, and pair it with the window's middle.
+ */
+static void tsc_stamp(unsigned long long *cyc, double *ns)
+{
+    int i;
+    double best = 0;
+
+    for (i = 0; i < 8; i++) {
+        double t0 = raw_ns();
+        unsigned long long c = tsc_begin();
+        double t1 = raw_ns();
+        if (i == 0 || t1 - t0 < best) {
+            best = t1 - t0;
+            *cyc = c;
+            *ns = (t0 + t1) / 2;
+        }
     }
-    return result;
 }
-/* $end x86cyclecounter */
+
+#define CALIB_ROUNDS 3
+#define CALIB_NS     50e6  /* length of one calibration round */
+
+/*
+ * tsc_calibrate - Measure the TSC rate in MHz against CLOCK_MONOTONIC_RAW,
+ *     taking the median of a few rounds. An invariant TSC keeps ticking
+ *     while we sleep; otherwise we spin, so the core runs at the speed
+ *     it will time the traces at.
+ */
+static double tsc_calibrate(int invariant)
+{
+    double rate[CALIB_ROUNDS], t;
+    int i, j;
+
+    for (i = 0; i < CALIB_ROUNDS; i++) {
+        unsigned long long c0, c1;
+        double ns0, ns1;
+        struct timespec req = { 0, (long)CALIB_NS };
+
+        tsc_stamp(&c0, &ns0);
+        if (invariant)
+            nanosleep(&req, NULL);
+        else
+            while (raw_ns() - ns0 < CALIB_NS)
+                ;
+        tsc_stamp(&c1, &ns1);
+        rate[i] = (c1 - c0) * 1e3 / (ns1 - ns0);
+
+        /* insertion sort, for the median */
+        for (j = i; j > 0 && rate[j-1] > rate[j]; j--) {
+            t = rate[j-1];
+            rate[j-1] = rate[j];
+            rate[j] = t;
+        }
+    }
+    return rate[CALIB_ROUNDS / 2];
+}
 
 #elif defined(__alpha)
 
@@ -181,37 +268,41 @@ double ovhd()
 }
 
 /* $begin mhz */
-/* Get the clock rate from /proc */
+/*
+ * mhz_full - Rate of the cycle counter in MHz. On x86 the TSC is
+ *     calibrated against CLOCK_MONOTONIC_RAW, which takes about 150 ms;
+ *     elsewhere we trust /proc/cpuinfo. sleeptime is no longer used.
+ */
 double mhz_full(int verbose, int sleeptime __attribute__((unused)))
 {
-    static char buf[2048];
+    double mhz = 0.0;
 
+#if defined(__i386__) || defined(__x86_64__)
+    int invariant = tsc_invariant();
+
+    mhz = tsc_calibrate(invariant);
+    if (verbose) {
+        printf("Processor clock rate ~= %.1f MHz (%s TSC)\n", mhz,
+               invariant ? "invariant" : "variable");
+        if (!invariant)
+            printf("Warning: the TSC rate may change with the CPU frequency\n");
+    }
+#else
+    static char buf[2048];
     FILE *fp = fopen("/proc/cpuinfo", "r");
-    double mhz = 0.0;
 
-    while (fgets(buf, 2048, fp)) {
+    while (fp && fgets(buf, 2048, fp)) {
         if (strstr(buf, "cpu MHz")) {
             sscanf(buf, "cpu MHz\t: %lf", &mhz);
             break;
         }
     }
-    fclose(fp);
-    /* Get mhz from vm could be different, so set it static */
-    mhz = 2000;
+    if (fp)
+        fclose(fp);
     if (verbose) 
         printf("Processor clock rate ~= %.1f MHz\n", mhz);
-    return mhz;
-
-#if 0
-    double rate;
-
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", rate);
-    return rate;
 #endif
+    return mhz;
 }
 /* $end mhz */
 
@@ -20,3 +20,39 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+/*
+ * Serialized cycle counter reads, for timing short code sequences such
+ * as a single malloc call: tsc_begin() waits for earlier instructions
+ * before reading the counter, and tsc_end() keeps later instructions
+ * from starting before it has read it.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+static inline unsigned long long tsc_begin(void)
+{
+    unsigned hi, lo;
+    asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static inline unsigned long long tsc_end(void)
+{
+    unsigned hi, lo, aux;
+    asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
+}
+#else
+#include <time.h>
+/* No cycle counter here, so count nanoseconds instead */
+static inline unsigned long long tsc_begin(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long tsc_end(void)
+{
+    return tsc_begin();
+}
+#endif
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -22,6 +23,10 @@
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
 #define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
 #define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CI_WIDTH 0.02        /* Stop when the CI is this narrow, relatively */
+#define CI_MIN_SAMPLES 5     /* Samples before the first bootstrap */
+#define CI_MAX_SAMPLES 1000  /* Give up on the interval after this many */
+#define BOOTSTRAP 1000       /* Resamples per bootstrap */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -30,11 +35,14 @@ static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static double ci_width = CI_WIDTH;
 
 static int *cache_buf = NULL;
+static void (*clear_hook)(void) = NULL;
 
 static double *values = NULL;
 static int samplecount = 0;
+static double spread = 0;      /* relative spread of the last K-best set */
 
 /* for debugging only */
 #define KEEP_VALS 0
@@ -113,6 +121,9 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages all map the one zero page, which would not
+	   evict anything; give the buffer real pages */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -121,36 +132,51 @@ static void clear()
 	cptr += incr;
     }
     sink = x;
+    if (clear_hook)
+	clear_hook();
 }
 
 /*
- * fcyc - Use K-best scheme to estimate the running time of function f
+ * fcyc_prepare - Bring the cache into the state a sample starts from
  */
-double fcyc(test_funct f, void *argp)
+void fcyc_prepare(void)
 {
-    double result;
-    init_sampler();
+    if (clear_cache)
+	clear();
+}
+
+/*
+ * sample - Time one run of f, or let g run and time itself
+ */
+static double sample(test_funct f, timed_funct g, void *argp)
+{
+    double cyc;
+
+    if (g)
+	return g(argp);
+    fcyc_prepare();
     if (compensate) {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_comp_counter();
-	    f(argp);
-	    cyc = get_comp_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
+	start_comp_counter();
+	f(argp);
+	cyc = get_comp_counter();
     } else {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_counter();
-	    f(argp);
-	    cyc = get_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
+	start_counter();
+	f(argp);
+	cyc = get_counter();
     }
+    return cyc;
+}
+
+/*
+ * kbest_of - Use K-best scheme to estimate the running time of f or g
+ */
+static double kbest_of(test_funct f, timed_funct g, void *argp)
+{
+    double result;
+    init_sampler();
+    do {
+	add_sample(sample(f, g, argp));
+    } while (!has_converged() && samplecount < maxsamples);
 #ifdef DEBUG
     {
 	int i;
@@ -160,6 +186,10 @@ double fcyc(test_funct f, void *argp)
     }
 #endif
     result = values[0];
+    {
+	int n = samplecount < kbest ? samplecount : kbest;
+	spread = values[0] > 0 ? (values[n-1] - values[0]) / values[0] : 0;
+    }
 #if !KEEP_VALS
     free(values); 
     values = NULL;
@@ -167,6 +197,174 @@ double fcyc(test_funct f, void *argp)
     return result;  
 }
 
+/*
+ * fcyc - Use K-best scheme to estimate the running time of function f
+ */
+double fcyc(test_funct f, void *argp)
+{
+    return kbest_of(f, NULL, argp);
+}
+
+/*
+ * fcyc_timed - fcyc for a function that times itself, such as one
+ *     that runs the code under test in a child process
+ */
+double fcyc_timed(timed_funct g, void *argp)
+{
+    return kbest_of(NULL, g, argp);
+}
+
+
+/*
+ * select_kth - Quickselect: rearrange a[0..n-1] so that a[k] is the
+ *     k-th smallest, and return it
+ */
+static double select_kth(double *a, int n, int k)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+	double pivot = a[(lo + hi) / 2];
+	int i = lo, j = hi;
+	while (i <= j) {
+	    while (a[i] < pivot)
+		i++;
+	    while (a[j] > pivot)
+		j--;
+	    if (i <= j) {
+		double t = a[i];
+		a[i++] = a[j];
+		a[j--] = t;
+	    }
+	}
+	if (k <= j)
+	    hi = j;
+	else if (k >= i)
+	    lo = i;
+	else
+	    break;
+    }
+    return a[k];
+}
+
+static double median(double *a, int n)
+{
+    double m = select_kth(a, n, n / 2);
+    if (n % 2 == 0)
+	m = (m + select_kth(a, n / 2, n / 2 - 1)) / 2;
+    return m;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * bootstrap - 95% percentile bootstrap interval for the median of the
+ *     n samples in s, resampled BOOTSTRAP times with a fixed seed so
+ *     that the same samples always give the same interval
+ */
+static void bootstrap(const double *s, int n, double *lo, double *hi)
+{
+    static double meds[BOOTSTRAP];
+    double *r = malloc(n * sizeof(double));
+    unsigned long long x = 0x9E3779B97F4A7C15ULL;
+    int b, i;
+
+    if (!r) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in bootstrap\n");
+	exit(1);
+    }
+    for (b = 0; b < BOOTSTRAP; b++) {
+	for (i = 0; i < n; i++) {
+	    x ^= x << 13;
+	    x ^= x >> 7;
+	    x ^= x << 17;
+	    r[i] = s[x % n];
+	}
+	meds[b] = median(r, n);
+    }
+    free(r);
+    qsort(meds, BOOTSTRAP, sizeof(double), cmp_double);
+    *lo = meds[(int)(0.025 * BOOTSTRAP)];
+    *hi = meds[(int)(0.975 * BOOTSTRAP) - 1];
+}
+
+/*
+ * fcyc_median - Estimate the running time of f by the median of its
+ *     samples rather than the minimum. Sampling stops once the
+ *     bootstrap interval of the median is within ci_width of it, once
+ *     the samples add up to budget cycles, or at CI_MAX_SAMPLES, but
+ *     never before CI_MIN_SAMPLES. The interval goes in *lo and *hi.
+ */
+static double median_of(test_funct f, timed_funct g, void *argp,
+			double budget, double *lo, double *hi)
+{
+    double *s = malloc(CI_MAX_SAMPLES * sizeof(double));
+    double *tmp = malloc(CI_MAX_SAMPLES * sizeof(double));
+    double spent = 0, result;
+    int n = 0, next_check = CI_MIN_SAMPLES;
+
+    if (!s || !tmp) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fcyc_median\n");
+	exit(1);
+    }
+    *lo = *hi = 0;
+    for (;;) {
+	s[n] = sample(f, g, argp);
+	spent += s[n++];
+	if (n < CI_MIN_SAMPLES ||
+	    (n < next_check && spent < budget && n < CI_MAX_SAMPLES))
+	    continue;
+
+	/* bootstrapping is O(n) per resample, so look less often as n grows */
+	memcpy(tmp, s, n * sizeof(double));
+	result = median(tmp, n);
+	bootstrap(s, n, lo, hi);
+	if (*hi - *lo <= ci_width * result || spent >= budget ||
+	    n >= CI_MAX_SAMPLES)
+	    break;
+	next_check = n + (n / 8 > 1 ? n / 8 : 1);
+    }
+    spread = result > 0 ? (*hi - *lo) / (2 * result) : 0;
+    samplecount = n;
+    free(s);
+    free(tmp);
+    return result;
+}
+
+double fcyc_median(test_funct f, void *argp, double budget,
+		   double *lo, double *hi)
+{
+    return median_of(f, NULL, argp, budget, lo, hi);
+}
+
+/* fcyc_median_timed - fcyc_median for a function that times itself */
+double fcyc_median_timed(timed_funct g, void *argp, double budget,
+			 double *lo, double *hi)
+{
+    return median_of(NULL, g, argp, budget, lo, hi);
+}
+
+/*
+ * fcyc_samples - Number of samples taken by the last fcyc or fcyc_median
+ */
+int fcyc_samples(void)
+{
+    return samplecount;
+}
+
+/*
+ * fcyc_spread - Relative spread (max-min)/min of the K best samples
+ *     in the last call to fcyc. Within epsilon if it converged.
+ */
+double fcyc_spread(void)
+{
+    return spread;
+}
+
 
 /*************************************************************
  * Set the various parameters used by the measurement routines 
@@ -206,6 +404,16 @@ void set_fcyc_cache_block(int bytes) {
 }
 
 
+/* 
+ * set_fcyc_clear_hook - Function to call after clearing the cache,
+ *     or NULL for none
+ *     Default = NULL
+ */
+void set_fcyc_clear_hook(void (*hook)(void))
+{
+    clear_hook = hook;
+}
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -245,6 +453,16 @@ void set_fcyc_epsilon(double epsilon_arg)
     epsilon = epsilon_arg;
 }
 
+/* 
+ * set_fcyc_ci_width - Relative width of the median's confidence
+ *     interval at which fcyc_median stops sampling
+ *     Default = 0.02
+ */
+void set_fcyc_ci_width(double width)
+{
+    ci_width = width;
+}
+
 
 
 
@@ -13,6 +13,31 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/*
+ * A test function that times itself and returns the cycles it took.
+ * It should call fcyc_prepare just before it starts its counter.
+ */
+typedef double (*timed_funct)(void *);
+double fcyc_timed(timed_funct g, void *argp);
+double fcyc_median_timed(timed_funct g, void *argp, double budget,
+                         double *lo, double *hi);
+void fcyc_prepare(void);
+
+/*
+ * Estimate the cycles used by f by the median of a variable number of
+ * samples, with a 95% bootstrap confidence interval in *lo and *hi.
+ * Sampling stops early if it takes more than budget cycles.
+ */
+double fcyc_median(test_funct f, void *argp, double budget,
+                   double *lo, double *hi);
+
+/* Relative spread of the K best samples in the last call to fcyc, or
+   the relative half-width of the interval after fcyc_median */
+double fcyc_spread(void);
+
+/* Number of samples behind the last fcyc or fcyc_median */
+int fcyc_samples(void);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -36,6 +61,13 @@ void set_fcyc_cache_size(int bytes);
  */
 void set_fcyc_cache_block(int bytes);
 
+/* 
+ * set_fcyc_clear_hook - Function to call after clearing the cache,
+ *     or NULL for none
+ *     Default = NULL
+ */
+void set_fcyc_clear_hook(void (*hook)(void));
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -63,6 +95,13 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/*
+ * set_fcyc_ci_width - Relative width of the confidence interval at
+ *     which fcyc_median stops sampling
+ *     Default = 0.02
+ */
+void set_fcyc_ci_width(double width);
+
 
 
 
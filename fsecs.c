@@ -2,11 +2,13 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
+#include "perfctr.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
 
@@ -26,7 +28,9 @@ void init_fsecs(void)
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
+    /* K-best already throws out samples hit by timer interrupts, and
+       the tick compensation costs a second of calibration at startup */
+    set_fcyc_compensate(0);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
@@ -55,3 +59,195 @@ double fsecs(fsecs_test_funct f, void *argp)
 }
 
 
+
+/*
+ * fsecs_median - Return the median running time of f (in seconds), and
+ *     a 95% confidence interval for it in *lo and *hi, spending about
+ *     budget seconds on the samples. The interval timers have no such
+ *     mode, and report their usual estimate as an empty interval.
+ */
+double fsecs_median(fsecs_test_funct f, void *argp, double budget,
+                    double *lo, double *hi)
+{
+#if USE_FCYC
+    double cycles = fcyc_median(f, argp, budget*Mhz*1e6, lo, hi);
+    *lo /= Mhz*1e6;
+    *hi /= Mhz*1e6;
+    return cycles/(Mhz*1e6);
+#else
+    *lo = *hi = fsecs(f, argp);
+    return *lo;
+#endif
+}
+
+/*
+ * fsecs_timed - fsecs for a function that times itself: g returns the
+ *     cycles it took by clock.c's counter, and calls fsecs_prepare just
+ *     before starting it
+ */
+double fsecs_timed(fsecs_timed_funct g, void *argp)
+{
+#if USE_FCYC
+    return fcyc_timed(g, argp)/(Mhz*1e6);
+#else
+    if (Mhz == 0)
+	Mhz = mhz(verbose > 0);
+    return g(argp)/(Mhz*1e6);
+#endif
+}
+
+/* fsecs_median_timed - fsecs_median for a function that times itself */
+double fsecs_median_timed(fsecs_timed_funct g, void *argp, double budget,
+                          double *lo, double *hi)
+{
+#if USE_FCYC
+    double cycles = fcyc_median_timed(g, argp, budget*Mhz*1e6, lo, hi);
+    *lo /= Mhz*1e6;
+    *hi /= Mhz*1e6;
+    return cycles/(Mhz*1e6);
+#else
+    *lo = *hi = fsecs_timed(g, argp);
+    return *lo;
+#endif
+}
+
+/*
+ * fsecs_prepare - Bring the cache into the state the samples of fsecs
+ *     start from, for functions that time themselves
+ */
+void fsecs_prepare(void)
+{
+#if USE_FCYC
+    fcyc_prepare();
+#endif
+}
+
+/*
+ * llc_geometry - Size and line size of the last-level cache, from the
+ *     highest-level data or unified cache that sysfs lists for cpu0.
+ *     Falls back to 8MB and 64-byte lines.
+ */
+static void llc_geometry(int *bytes, int *line)
+{
+    char path[128], type[32];
+    int i, level, best = 0;
+    unsigned size, ls;
+    char unit;
+    FILE *fp;
+
+    *bytes = 8 << 20;
+    *line = 64;
+    for (i = 0; i < 16; i++) {
+        sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        if ((fp = fopen(path, "r")) == NULL)
+            break;
+        if (fscanf(fp, "%d", &level) != 1)
+            level = 0;
+        fclose(fp);
+
+        sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if ((fp = fopen(path, "r")) == NULL)
+            continue;
+        if (fscanf(fp, "%31s", type) != 1 || type[0] == 'I')
+            level = 0;                 /* skip instruction caches */
+        fclose(fp);
+
+        sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if (level <= best || (fp = fopen(path, "r")) == NULL)
+            continue;
+        if (fscanf(fp, "%u%c", &size, &unit) == 2) {
+            best = level;
+            *bytes = size << (unit == 'M' ? 20 : unit == 'K' ? 10 : 0);
+        }
+        fclose(fp);
+
+        sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/"
+                "coherency_line_size", i);
+        if ((fp = fopen(path, "r")) != NULL) {
+            if (fscanf(fp, "%u", &ls) == 1 && ls > 0)
+                *line = ls;
+            fclose(fp);
+        }
+    }
+}
+
+/*
+ * fsecs_mode - Set the cache state the following measurements start
+ *     from. A cold sample first walks a buffer half again as large as
+ *     the LLC, a line at a time, so that replacement policies that are
+ *     not quite LRU still lose the previous sample's lines; discard,
+ *     if not NULL, then runs too (mdriver uses it to drop the heap's
+ *     pages). A warm sample just follows the previous one.
+ */
+void fsecs_mode(int mode, void (*discard)(void))
+{
+#if USE_FCYC
+    static int llc_bytes = 0, llc_line;
+
+    switch (mode) {
+    case FSECS_COLD:
+        if (llc_bytes == 0) {
+            llc_geometry(&llc_bytes, &llc_line);
+            if (verbose > 1)
+                printf("Cold runs flush a %d KB LLC with %d-byte lines.\n",
+                       llc_bytes >> 10, llc_line);
+        }
+        set_fcyc_cache_size(llc_bytes + llc_bytes / 2);
+        set_fcyc_cache_block(llc_line);
+        set_fcyc_clear_cache(1);
+        set_fcyc_clear_hook(discard);
+        break;
+    case FSECS_WARM:
+        set_fcyc_clear_cache(0);
+        set_fcyc_clear_hook(NULL);
+        break;
+    default:
+        /* as init_fsecs leaves it, with fcyc's default buffer */
+        set_fcyc_cache_size(1<<19);
+        set_fcyc_cache_block(32);
+        set_fcyc_clear_cache(1);
+        set_fcyc_clear_hook(NULL);
+        break;
+    }
+#endif
+}
+
+/*
+ * fsecs_noise - Relative noise of the last fsecs measurement, or 0
+ *     if the timer in use gives no estimate of its own
+ */
+double fsecs_noise(void)
+{
+#if USE_FCYC
+    return fcyc_spread();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * fsecs_counters - Run f a few times under the hardware counters and
+ *     keep the counts from the run with the fewest cycles, in the
+ *     spirit of K-best. Returns 0, leaving *pc untouched, if this host
+ *     has no counters; the caller then has only the timers to go on.
+ */
+#define COUNTER_RUNS 3
+
+int fsecs_counters(fsecs_test_funct f, void *argp, perfctr_t *pc)
+{
+    perfctr_t run;
+    int i;
+
+    if (perfctr_init() == 0)
+        return 0;
+
+    for (i = 0; i < COUNTER_RUNS; i++) {
+        perfctr_start();
+        f(argp);
+        perfctr_stop(&run);
+        if (i == 0 || (run.valid[PC_CYCLES] &&
+                       run.count[PC_CYCLES] < pc->count[PC_CYCLES]))
+            *pc = run;
+    }
+    return 1;
+}
@@ -1,4 +1,24 @@
+#include "perfctr.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_noise(void);
+double fsecs_median(fsecs_test_funct f, void *argp, double budget,
+                    double *lo, double *hi);
+int fsecs_counters(fsecs_test_funct f, void *argp, perfctr_t *pc);
+
+/* For functions that time themselves, e.g. in a child process, and
+   return the cycles they took; they call fsecs_prepare just before */
+typedef double (*fsecs_timed_funct)(void *);
+double fsecs_timed(fsecs_timed_funct g, void *argp);
+double fsecs_median_timed(fsecs_timed_funct g, void *argp, double budget,
+                          double *lo, double *hi);
+void fsecs_prepare(void);
+
+/* Cache state for the measurements that follow, see fsecs_mode */
+#define FSECS_DEFAULT 0   /* init_fsecs's small cache clear */
+#define FSECS_COLD    1   /* flush the whole LLC before each sample */
+#define FSECS_WARM    2   /* back-to-back samples, nothing flushed */
+void fsecs_mode(int mode, void (*discard)(void));
@@ -0,0 +1,34 @@
+/*
+ * heapsnap.h - binary heap snapshots written by mdriver -H
+ *
+ * A snapshot file holds one record per requested op number, back to
+ * back. Each record is a header followed by one heapsnap_block_t per
+ * block, in address order, as reported by mm_heapwalk. All fields are
+ * little-endian, which is what the driver runs on, and offsets and
+ * sizes fit in 32 bits because MAX_HEAP does.
+ */
+#ifndef __HEAPSNAP_H_
+#define __HEAPSNAP_H_
+
+#include <stdint.h>
+
+#define HS_MAGIC   "MMHEAPSN"   /* first 8 bytes of every record */
+#define HS_VERSION 1
+
+typedef struct {
+    char magic[8];               /* HS_MAGIC */
+    uint32_t version;            /* HS_VERSION */
+    uint32_t opnum;              /* taken after this many ops */
+    uint64_t heap_size;          /* mem_heapsize() at the time */
+    uint64_t live_bytes;         /* payload bytes the trace had live */
+    uint64_t num_blocks;         /* heapsnap_block_t records that follow */
+} heapsnap_hdr_t;
+
+typedef struct {
+    uint32_t offset;             /* payload offset from the heap start */
+    uint32_t size;               /* block size; bit 0 set if allocated */
+} heapsnap_block_t;
+
+#define HS_ALLOC 1
+
+#endif /* __HEAPSNAP_H_ */
@@ -0,0 +1,101 @@
+/*
+ * lathist.c - log-bucketed latency histograms, see lathist.h
+ */
+#include <string.h>
+#include "lathist.h"
+#include "clock.h"
+
+/*
+ * bucket_of - Values below LAT_SUB get a bucket each. Above that, the
+ *     bucket is the position of the top bit plus the LAT_SUB_BITS bits
+ *     just below it.
+ */
+static int bucket_of(unsigned long long v)
+{
+    int top;
+
+    if (v < LAT_SUB)
+        return (int)v;
+    top = 63 - __builtin_clzll(v);
+    return ((top - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+        (int)((v >> (top - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/*
+ * bucket_max - Largest value that falls in bucket b
+ */
+static unsigned long long bucket_max(int b)
+{
+    int top;
+
+    if (b < LAT_SUB)
+        return b;
+    top = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    return ((unsigned long long)((b & (LAT_SUB - 1)) | LAT_SUB)
+            << (top - LAT_SUB_BITS)) +
+        ((1ULL << (top - LAT_SUB_BITS)) - 1);
+}
+
+void lathist_clear(lathist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void lathist_add(lathist_t *h, unsigned long long v)
+{
+    h->buckets[bucket_of(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+void lathist_merge(lathist_t *dst, const lathist_t *src)
+{
+    int b;
+
+    for (b = 0; b < LAT_BUCKETS; b++)
+        dst->buckets[b] += src->buckets[b];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/*
+ * lathist_percentile - Reports the top of the bucket holding the p'th
+ *     sample, but never more than the largest sample seen.
+ */
+unsigned long long lathist_percentile(const lathist_t *h, double p)
+{
+    unsigned long long rank, seen = 0;
+    int b;
+
+    if (h->count == 0)
+        return 0;
+    rank = (unsigned long long)(p * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            break;
+    }
+    return bucket_max(b) < h->max ? bucket_max(b) : h->max;
+}
+
+/*
+ * lathist_timer_overhead - Take the minimum over many tries, which is
+ *     what the timer adds to every sample when nothing interferes.
+ */
+unsigned long long lathist_timer_overhead(void)
+{
+    unsigned long long best = ~0ULL;
+    int i;
+
+    for (i = 0; i < 10000; i++) {
+        unsigned long long t0 = tsc_begin();
+        unsigned long long t1 = tsc_end();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    return best;
+}
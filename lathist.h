@@ -0,0 +1,36 @@
+/*
+ * lathist.h - log-bucketed latency histograms
+ *
+ * Each power of two is split into LAT_SUB sub-buckets, so a percentile
+ * read from a histogram is within 1/LAT_SUB of the true value, however
+ * long the tail is.
+ */
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#define LAT_SUB_BITS 3
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  (64 * LAT_SUB)
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long max;
+    unsigned long long buckets[LAT_BUCKETS];
+} lathist_t;
+
+/* Empty a histogram */
+void lathist_clear(lathist_t *h);
+
+/* Record one latency */
+void lathist_add(lathist_t *h, unsigned long long v);
+
+/* Add every sample in src to dst */
+void lathist_merge(lathist_t *dst, const lathist_t *src);
+
+/* The latency at or below which a fraction p of the samples fall */
+unsigned long long lathist_percentile(const lathist_t *h, double p);
+
+/* Cost of a tsc_begin/tsc_end pair with nothing between them */
+unsigned long long lathist_timer_overhead(void);
+
+#endif /* __LATHIST_H_ */
@@ -7,23 +7,39 @@
  * Copyright (c) 2004-2015, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "bintrace.h"
+#include "lathist.h"
+#include "perfctr.h"
+#include "heapsnap.h"
+#include "mmplugin.h"
 
 /**********************
  * Constants and macros
@@ -37,6 +53,10 @@
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* Threaded replay */
+#define MAX_THREADS   64 /* highest @tid a trace may use, plus one */
+#define THREAD_RUNS    3 /* replays per trace; the fastest is reported */
+
 /* weights */
 #define WNONE 0
 #define WALL 1
@@ -54,14 +74,23 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The ranges form a treap
+ * ordered by lo (a binary search tree that is also a heap on the random
+ * prio), so finding, adding and removing a range take O(log n) time.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges with lower addresses */
+    struct range_t *right; /* ranges with higher addresses */
+    unsigned prio;         /* heap key, never smaller than the children's */
     int index;             /* same index as free; for debugging */
 } range_t;
 
+/* Range records are carved out of slabs of this many */
+#define RANGE_SLAB 4096
+
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
     enum { ALLOC, FREE, REALLOC } type; /* type of request */
@@ -69,10 +98,17 @@ typedef struct {
     size_t size;                      /* byte size of alloc/realloc request */
 } traceop_t;
 
+/* Checksum of the random data last written to a block (-x) */
+typedef struct {
+    uint64_t sum;
+    size_t size;         /* number of bytes the sum covers */
+} blocksum_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* used to turn off range checks for big traces;
+                            now accepted but ignored */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
@@ -80,8 +116,20 @@ typedef struct {
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
+    blocksum_t *block_sums; /* checksum of each block's random data (-x) */
+    int num_threads;     /* 1 + highest @tid in the trace */
+    int *op_tids;        /* thread of each op; NULL if there are no @tids */
+    int num_barriers;    /* number of b lines */
+    int *barriers;       /* barrier k comes just before op barriers[k] */
+    /* The ops again as separate arrays, for replay; see encode_ops */
+    unsigned char *op_type;
+    uint32_t *op_slot;   /* index into blocks; num_ids for free(NULL) */
+    uint32_t *op_size;
 } trace_t;
 
+/* replay prefetches the block slot of the op this many ahead */
+#define PREFETCH_AHEAD 16
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -90,6 +138,7 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+    int steady_from;          /* op the snapshot is taken at, with -k */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -105,10 +154,115 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double noise;    /* relative spread of the timing samples behind secs */
+    double secs_lo;  /* 95% confidence interval of secs with -I, else 0 */
+    double secs_hi;
+    double secs_warm; /* secs of back-to-back runs with -w, else 0 */
+    int steady_from;  /* with -k, the op the snapshot was taken at */
+    double secs_warmup; /* with -k, secs of the ops before it... */
+    double secs_steady; /* ...and of the ops from it on, else 0 */
+    double secs_null; /* with -n, secs of the trace on the null allocator */
+    int counted;     /* were hardware counters read for this trace (-P)? */
+    perfctr_t ctr;   /* counts for one run of the trace */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/*
+ * Streaming replay (-S) never holds a whole trace in memory. A reader
+ * thread parses ops into one of two fixed-size chunks while the driver
+ * replays the other, and the blocks are kept in a hash table holding
+ * only the ids that are currently live.
+ */
+#define STREAM_CHUNK (1<<16)  /* ops per chunk */
+#define STREAM_BUF   (1<<20)  /* read buffer for binary traces */
+
+typedef struct {
+    traceop_t ops[STREAM_CHUNK];
+    int n;                    /* ops in this chunk; 0 marks end of trace */
+    int full;                 /* ready for the driver to replay */
+} chunk_t;
+
+typedef struct {
+    trace_t *trace;           /* header fields and filename only */
+    FILE *fp;                 /* text traces are read with fscanf... */
+    int fd;                   /* ... binary traces with read() */
+    unsigned char *buf;
+    size_t buf_pos, buf_len;
+    int prev_index;
+    unsigned last_size;       /* size of the last text alloc/realloc */
+    int ops_left;             /* ops the reader has yet to produce */
+    chunk_t *chunks;          /* the two chunks */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} stream_t;
+
+/* One live block in the streaming replay's id -> block table */
+typedef struct {
+    int index;                /* trace id, or -1 if the slot is empty */
+    int rand_base;            /* index into random_data, if debug is on */
+    char *p;
+    size_t size;
+    uint64_t sum;             /* checksum of its random data (-x) */
+} live_t;
+
+typedef struct {
+    live_t *slots;
+    size_t mask;              /* number of slots - 1, a power of two */
+    size_t count;
+} livemap_t;
+
+/*
+ * With -L, every request is timed on its own, and the latencies are
+ * kept in histograms by request type and by size class. Size classes
+ * are powers of 8 from 64 bytes; free is classed by the block's size.
+ */
+#define LAT_CLASSES 5
+static const char *lat_class_names[LAT_CLASSES] = {
+    "<=64", "<=512", "<=4K", "<=32K", ">32K"
+};
+
+typedef struct {
+    lathist_t hist[3][LAT_CLASSES]; /* by traceop_t type and size class */
+} latency_t;
+
+/*
+ * A trace with @tid requests is also replayed on real threads. Each
+ * thread makes its own requests in file order; a request waits until
+ * the earlier requests on the same id are done, so a block can be
+ * freed by another thread than the one that allocated it. mm.c is not
+ * thread-safe, so the mm calls themselves are serialized by a mutex.
+ */
+typedef struct {
+    trace_t *trace;
+    int *seq;                 /* per op: earlier ops on the same id */
+    int *done;                /* per id: its ops replayed so far */
+    pthread_mutex_t lock;     /* held around every mm call */
+    pthread_barrier_t barrier;
+} replay_t;
+
+typedef struct {
+    replay_t *replay;
+    int *stream;              /* this thread's op numbers; -1 is a barrier */
+    int len;
+    int ops;                  /* requests in stream */
+    double begin, end;        /* CLOCK_MONOTONIC secs */
+} replay_thread_t;
+
+/* Per-thread throughput of the fastest threaded replay */
+typedef struct {
+    int threads;
+    double wall;              /* first thread start to last thread end */
+    int ops[MAX_THREADS];
+    double secs[MAX_THREADS];
+} thread_stats_t;
+
+/* What a -j worker process sends back to the parent for its trace */
+typedef struct {
+    int errors;      /* errors found by the worker */
+    stats_t stats;   /* the worker's stats for its trace */
+} result_msg_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
@@ -124,6 +278,11 @@ typedef struct {
  * realloc and when we free.  With DBG_EXPENSIVE, we check every block
  * every operation.
  * randint_t should be a byte, in case students return unaligned memory.
+ * The fill and check kernels still move whole words: a block is copied
+ * from (or compared against) random_data in runs that only wrap around
+ * at the end of random_data, never per byte.
+ * With -x, we also keep a checksum of each block's data and verify that
+ * instead, comparing against random_data only to locate garbled bytes.
  *******************/
 #define RANDOM_DATA_LEN (1<<16)
 typedef unsigned char randint_t;
@@ -137,6 +296,9 @@ static randint_t random_data[RANDOM_DATA_LEN];
 
 static enum { DBG_NONE, DBG_CHEAP, DBG_EXPENSIVE } debug_mode = DBG_CHEAP;
 
+/* verify block data by checksum (-x) */
+static int checksum_mode = 0;
+
 int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
@@ -144,6 +306,66 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* number of traces to evaluate concurrently (-j) */
+static int num_jobs = 1;
+
+/* replay traces in streaming mode (-S) */
+static int stream_mode = 0;
+
+/* record per-request latency histograms (-L) */
+static int latency_mode = 0;
+
+/* time each trace by the median of its samples, with a confidence
+   interval, spending at most this many secs on the samples (-I) */
+static double ci_budget = 0;
+
+/* time each trace from a flushed LLC, and again warm (-w); with -z,
+   also drop the heap's pages before each cold run */
+static int warm_mode = 0;
+static int discard_mode = 0;
+
+/* also time the ops before and after a snapshot of the heap taken at
+   op steady_op, or at steady_pct percent of the trace, apart (-k) */
+static int steady_mode = 0;
+static int steady_op = 0;
+static double steady_pct = -1;
+
+/* also time each trace against the null allocator, to take the
+   driver's own share out of secs (-n) */
+static int null_mode = 0;
+static allocator_t null_allocator;
+
+/* read hardware performance counters around each speed run (-P) */
+static int counter_mode = 0;
+
+/* sample the heap every this many ops into a timeline file (-T) */
+static int timeline_ops = 0;
+
+/* write heap snapshots after these op counts, in ascending order (-H) */
+static int *snap_ops = NULL;
+static int num_snaps = 0;
+
+/* write per-trace results to this file (-o), and compare against a
+   baseline written earlier the same way (-b) */
+static char *result_file = NULL;
+static char *baseline_file = NULL;
+
+/* the allocators to evaluate: the linked-in mm package, then any
+   plug-ins loaded with -a. Every mm call in this file goes through
+   the current one. */
+#define MAX_ALLOCATORS 8
+static allocator_t allocators[MAX_ALLOCATORS];
+static int num_allocators = 1;
+static allocator_t *allocator = &allocators[0];
+
+#define mm_init()             (allocator->init())
+#define mm_malloc(size)       (allocator->malloc(size))
+#define mm_free(ptr)          (allocator->free(ptr))
+#define mm_realloc(ptr, size) (allocator->realloc(ptr, size))
+#define mm_checkheap(lineno)  (allocator->checkheap(lineno))
+#define mm_heapstats(f, l)    (allocator->heapstats(f, l))
+#define mm_heapwalk(fn, arg)  (allocator->heapwalk(fn, arg))
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -167,15 +389,22 @@ static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
+static void fill_random(char *block, size_t size, int base);
+static int check_random(const char *block, size_t size, int base,
+                        int *firstgarbled);
+static uint64_t block_checksum(const char *block, size_t size);
 static void check_index(const trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static void read_bintrace(trace_t *trace);
+static void encode_ops(trace_t *trace);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -187,10 +416,36 @@ static void eval_libc_speed(void *ptr);
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
+static FILE *open_trace_output(const trace_t *trace, const char *suffix);
+static void sample_timeline(FILE *fp, int opnum, int live);
+static void write_snapshot(FILE *fp, int opnum, int live);
+static void parse_snap_ops(const char *list);
 static void eval_mm_speed(void *ptr);
+static void replay(trace_t *trace, int from, int to);
+static void measure_steady(speed_t *params, stats_t *stats);
+static void eval_mm_warmup(void *ptr);
+static double eval_mm_steady(void *ptr);
+static void prefault(void);
+static void eval_mm_latency(trace_t *trace, latency_t *lat);
+static void eval_mm_threads(trace_t *trace, thread_stats_t *ts);
+static void print_threads(const trace_t *trace, const thread_stats_t *ts);
+static void print_latency(const char *filename, const latency_t *lat);
+
+/* Routines for replaying a trace in streaming mode (-S) */
+static void eval_mm_stream(stats_t *stats, const char *tracedir,
+                           const char *filename, range_t **ranges);
+
+/* Runs the traces in forked worker processes (-j) */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printcounters(int n, const stats_t *stats);
+static void write_results(const char *filename, int n, const stats_t *stats,
+                          double util, double tput, double perfindex);
+static int compare_baseline(const char *filename, int n, const stats_t *stats);
+static void compare_allocators(int n, stats_t **stats);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -208,6 +463,54 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/*
+ * measure - Time f, the speed function for one trace, into stats: the
+ *     K-best minimum, or with -I the median and its confidence interval.
+ *     With -w the runs behind secs start from a flushed LLC, and
+ *     secs_warm is timed first, from runs that follow each other.
+ */
+static void measure(fsecs_test_funct f, speed_t *params, stats_t *stats)
+{
+    double lo, hi;
+
+    if (warm_mode) {
+        fsecs_mode(FSECS_WARM, NULL);
+        if (ci_budget > 0)
+            stats->secs_warm = fsecs_median(f, params, ci_budget, &lo, &hi);
+        else
+            stats->secs_warm = fsecs(f, params);
+        fsecs_mode(FSECS_COLD, discard_mode ? mem_discard : NULL);
+    }
+    if (ci_budget > 0)
+        stats->secs = fsecs_median(f, params, ci_budget,
+                                   &stats->secs_lo, &stats->secs_hi);
+    else
+        stats->secs = fsecs(f, params);
+    stats->noise = fsecs_noise();
+    if (warm_mode)
+        fsecs_mode(FSECS_DEFAULT, NULL);
+}
+
+/*
+ * measure_null - With -n, time the trace as measure does, against the
+ *     null allocator instead: what is left is what replay, reinit_trace
+ *     and memlib cost, which secs includes too. The null allocator never
+ *     fails, so the trace needs no checking first.
+ */
+static void measure_null(speed_t *params, stats_t *stats)
+{
+    allocator_t *saved = allocator;
+    double lo, hi;
+
+    allocator = &null_allocator;
+    if (ci_budget > 0)
+        stats->secs_null = fsecs_median(eval_mm_speed, params, ci_budget,
+                                        &lo, &hi);
+    else
+        stats->secs_null = fsecs(eval_mm_speed, params);
+    allocator = saved;
+}
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
@@ -216,6 +519,11 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     volatile int i;
     volatile int timed_out = 0;
 
+    if (num_jobs > 1 && num_tracefiles > 1 && !onetime_flag) {
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats);
+        return;
+    }
+
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
@@ -226,6 +534,13 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             timed_out = 1;
         }
 
+        if (stream_mode) {
+            if (!timed_out)
+                eval_mm_stream(&mm_stats[i], tracedir, tracefiles[i], &ranges);
+            mem_deinit();
+            continue;
+        }
+
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
@@ -250,7 +565,29 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            measure(eval_mm_speed, speed_params, &mm_stats[i]);
+            if (steady_mode)
+                measure_steady(speed_params, &mm_stats[i]);
+            if (null_mode)
+                measure_null(speed_params, &mm_stats[i]);
+            if (counter_mode)
+                mm_stats[i].counted = fsecs_counters(eval_mm_speed, speed_params,
+                                                     &mm_stats[i].ctr);
+
+            if (latency_mode) {
+                latency_t *lat = malloc(sizeof(latency_t));
+                if (lat == NULL)
+                    unix_error("malloc failed in run_tests");
+                eval_mm_latency(trace, lat);
+                print_latency(trace->filename, lat);
+                free(lat);
+            }
+
+            if (trace->num_threads > 1) {
+                thread_stats_t ts;
+                eval_mm_threads(trace, &ts);
+                print_threads(trace, &ts);
+            }
         }
 
         free_trace(trace);
@@ -260,6 +597,132 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_tests_parallel - Evaluate the traces in up to num_jobs forked
+ *     worker processes at a time, each pinned to its own core. A worker
+ *     runs exactly one trace through run_tests, with its own memlib
+ *     mapping, and writes its stats back to the parent over a pipe. The
+ *     parent fills in mm_stats in trace order, so printresults and the
+ *     perf index are the same as for a serial run.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats)
+{
+    cpu_set_t allowed, mask;
+    int *cpus;         /* the cores we are allowed to run on */
+    int num_cpus = 0;
+    pid_t *slot_pid;   /* worker running in each slot, or 0 */
+    int *slot_fd;      /* read end of that worker's pipe */
+    int *slot_trace;   /* trace that worker is evaluating */
+    int next = 0;      /* next trace to hand out */
+    int running = 0;
+    unsigned timeout_left;
+    int i, s;
+
+    /* The parent itself never runs a trace, so let each worker
+       inherit whatever is left of the overall timeout instead */
+    timeout_left = alarm(0);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity failed in run_tests_parallel");
+    if ((cpus = calloc(CPU_SETSIZE, sizeof(int))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+    for (i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, &allowed))
+            cpus[num_cpus++] = i;
+
+    /* Two workers on one core would time each other */
+    if (num_jobs > num_cpus) {
+        fprintf(stderr, "Warning: -j %d, but only %d cores are allowed; "
+                "using %d workers\n", num_jobs, num_cpus, num_cpus);
+        num_jobs = num_cpus;
+    }
+
+    if ((slot_pid = calloc(num_jobs, sizeof(pid_t))) == NULL ||
+        (slot_fd = calloc(num_jobs, sizeof(int))) == NULL ||
+        (slot_trace = calloc(num_jobs, sizeof(int))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+
+    if (verbose > 1)
+        printf("Running %d traces with %d workers on %d cores\n",
+               num_tracefiles, num_jobs, num_cpus);
+
+    while (next < num_tracefiles || running > 0) {
+        /* Start a worker in every free slot */
+        for (s = 0; s < num_jobs && next < num_tracefiles; s++) {
+            int fds[2];
+            pid_t pid;
+
+            if (slot_pid[s] != 0)
+                continue;
+            if (pipe(fds) < 0)
+                unix_error("pipe failed in run_tests_parallel");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_tests_parallel");
+
+            if (pid == 0) { /* worker */
+                result_msg_t msg;
+                speed_t speed_params;
+
+                close(fds[0]);
+                CPU_ZERO(&mask);
+                CPU_SET(cpus[s % num_cpus], &mask);
+                sched_setaffinity(0, sizeof(mask), &mask);
+                if (timeout_left > 0)
+                    alarm(timeout_left);
+
+                memset(&msg, 0, sizeof(msg));
+                num_jobs = 1;
+                run_tests(1, tracedir, &tracefiles[next], &msg.stats,
+                          NULL, &speed_params);
+                msg.errors = errors;
+                if (write(fds[1], &msg, sizeof(msg)) != sizeof(msg))
+                    _exit(1);
+                _exit(0);
+            }
+
+            close(fds[1]);
+            slot_pid[s] = pid;
+            slot_fd[s] = fds[0];
+            slot_trace[s] = next++;
+            running++;
+        }
+
+        /* Collect whichever worker finishes first */
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            unix_error("wait failed in run_tests_parallel");
+        for (s = 0; s < num_jobs && slot_pid[s] != pid; s++)
+            ;
+        if (s == num_jobs)
+            continue;
+
+        result_msg_t msg;
+        stats_t *stats = &mm_stats[slot_trace[s]];
+        if (read(slot_fd[s], &msg, sizeof(msg)) == sizeof(msg)) {
+            *stats = msg.stats;
+            errors += msg.errors;
+        } else {
+            /* The worker died before reporting, e.g. mm.c segfaulted */
+            snprintf(stats->filename, MAXLINE, "%s%s",
+                     tracedir, tracefiles[slot_trace[s]]);
+            stats->valid = 0;
+            errors++;
+            fprintf(stderr, "ERROR: worker for %s exited abnormally (status %d)\n",
+                    stats->filename, status);
+        }
+        close(slot_fd[s]);
+        slot_pid[s] = 0;
+        running--;
+    }
+
+    free(cpus);
+    free(slot_pid);
+    free(slot_fd);
+    free(slot_trace);
+}
+
 /**************
  * Main routine
  **************/
@@ -283,15 +746,17 @@ int main(int argc, char **argv)
     double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
     double util_weight = 0, perf_weight = 0;
     int numcorrect;
+    int regressions = 0;
 
 
     setbuf(stdout, 0);
     setbuf(stderr, 0);
+    mmplugin_builtin(&allocators[0]);
 
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "a:b:d:f:c:H:I:j:k:o:s:t:T:v:hnpLPSVAlDwxz")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -348,10 +813,116 @@ int main(int argc, char **argv)
             debug_mode = DBG_EXPENSIVE;
             break;
 
+        case 'x': /* Verify block data by checksum */
+            checksum_mode = 1;
+            break;
+
         case 's':
             set_timeout = atoi(optarg);
             break;
 
+        case 'I': { /* Median timing with confidence intervals, in a budget */
+            char *end;
+
+            errno = 0;
+            ci_budget = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || errno || !(ci_budget > 0))
+                app_error("-I takes a positive number of secs\n");
+            break;
+        }
+
+        case 'w': /* Time cold from a flushed LLC, and warm */
+            warm_mode = 1;
+            break;
+
+        case 'z': /* Cold runs also start with the heap's pages dropped */
+            warm_mode = discard_mode = 1;
+            break;
+
+        case 'k': { /* Time warm-up and steady state apart, split at an op */
+            char *end;
+
+            steady_mode = 1;
+            errno = 0;
+            if (optarg[0] != '\0' && optarg[strlen(optarg) - 1] == '%') {
+                steady_pct = strtod(optarg, &end);
+                if (end == optarg || *end != '%' ||
+                    !(steady_pct >= 0 && steady_pct <= 100))
+                    app_error("-k takes an op count or a percentage up to 100%%");
+            } else {
+                long op = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || errno || op < 0 ||
+                    op > INT_MAX)
+                    app_error("-k takes an op count or a percentage up to 100%%");
+                steady_op = (int)op;
+            }
+            break;
+        }
+
+        case 'n': /* Calibrate the driver's overhead with a null allocator */
+            null_mode = 1;
+            mmplugin_null(&null_allocator);
+            break;
+
+        case 'L': /* Print per-request latency percentiles */
+            latency_mode = 1;
+            break;
+
+        case 'H': /* Write heap snapshots after the listed op counts */
+            parse_snap_ops(optarg);
+            break;
+
+        case 'T': { /* Record a heap timeline, sampled every n ops */
+            char *end;
+            long n;
+
+            errno = 0;
+            n = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || errno || n < 1 || n > INT_MAX) {
+                fprintf(stderr, "-T takes a positive op count\n");
+                usage();
+                exit(1);
+            }
+            timeline_ops = (int)n;
+            break;
+        }
+
+        case 'P': /* Read hardware performance counters */
+            counter_mode = 1;
+            break;
+
+        case 'S': /* Stream traces instead of loading them whole */
+            stream_mode = 1;
+            break;
+
+        case 'j': { /* Evaluate traces in parallel worker processes */
+            char *end;
+            long n;
+
+            errno = 0;
+            n = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || errno || n < 1 || n > INT_MAX)
+                app_error("-j takes a positive number of workers\n");
+            num_jobs = (int)n;
+            break;
+        }
+
+        case 'o': /* Write per-trace results as JSON or CSV */
+            result_file = strdup(optarg);
+            break;
+
+        case 'a': /* Load an allocator plug-in to compare against mm */
+            if (num_allocators == MAX_ALLOCATORS)
+                app_error("At most %d allocators", MAX_ALLOCATORS);
+            if (mmplugin_load(&allocators[num_allocators], optarg) < 0)
+                app_error("Could not load %s: %s", optarg, mmplugin_error());
+            num_allocators++;
+            break;
+
+        case 'b': /* Compare against a baseline written by -o */
+            baseline_file = strdup(optarg);
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -374,6 +945,10 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (counter_mode && perfctr_init() == 0) {
+        printf("No hardware performance counters here, ignoring -P\n");
+        counter_mode = 0;
+    }
 
     /* Initialize the timeout */
     if (set_timeout > 0) {
@@ -404,7 +979,7 @@ int main(int argc, char **argv)
                 speed_params.trace = trace;
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                measure(eval_libc_speed, &speed_params, &libc_stats[i]);
             }
             free_trace(trace);
         }
@@ -444,6 +1019,8 @@ int main(int argc, char **argv)
         } else {
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
+            if (counter_mode)
+                printcounters(num_tracefiles, mm_stats);
             printf("\n");
         }
     }
@@ -455,6 +1032,40 @@ int main(int argc, char **argv)
                (float)(global_mm_sum_stats.tput/global_libc_sum_stats.tput));
     }
 
+    /*
+     * Optionally run the plug-ins over the same traces. Their errors
+     * are shown in their own results, and do not count against mm.
+     */
+    if (num_allocators > 1 && !onetime_flag) {
+        stats_t *all_stats[MAX_ALLOCATORS];
+        int mm_errors = errors;
+        int k;
+
+        all_stats[0] = mm_stats;
+        for (k = 1; k < num_allocators; k++) {
+            allocator = &allocators[k];
+            errors = 0;
+            if (verbose > 1)
+                printf("\nTesting %s\n", allocator->name);
+            all_stats[k] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+            if (all_stats[k] == NULL)
+                unix_error("plug-in stats calloc in main failed");
+            run_tests(num_tracefiles, tracedir, tracefiles, all_stats[k],
+                      ranges, &speed_params);
+            if (verbose > 1) {
+                sum_stats_t sumstats;
+                printf("\nResults for %s:\n", allocator->name);
+                printresults(num_tracefiles, all_stats[k], &sumstats);
+            }
+        }
+        allocator = &allocators[0];
+        errors = mm_errors;
+
+        compare_allocators(num_tracefiles, all_stats);
+        for (k = 1; k < num_allocators; k++)
+            free(all_stats[k]);
+    }
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -555,6 +1166,13 @@ int main(int argc, char **argv)
         printf("Terminated with %d errors\n", errors);
     }
 
+    /* Optionally save the results and compare them with a baseline */
+    if (result_file)
+        write_results(result_file, num_tracefiles, mm_stats,
+                      avg_mm_util, avg_mm_throughput, perfindex);
+    if (baseline_file)
+        regressions = compare_baseline(baseline_file, num_tracefiles, mm_stats);
+
     /* Optionally emit autoresult string */
     double raw_score = perfindex;
     double checkpoint_score = perfindex;
@@ -575,27 +1193,114 @@ int main(int argc, char **argv)
                 avg_mm_throughput/1000.0, avg_mm_util*100);
         printf("%s\n", autoresult);
     }
-    exit(0);
+    exit(regressions ? 1 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Unused range records, linked through their right pointers */
+static range_t *range_pool = NULL;
+
+/*
+ * new_range - Take a range record from the pool, refilling it with a
+ *     fresh slab when it runs dry. Records are never returned to libc.
+ */
+static range_t *new_range(void)
+{
+    static unsigned seed = 2463534242u;
+    range_t *p;
+
+    if (range_pool == NULL) {
+        int i;
+        if ((p = (range_t *)malloc(RANGE_SLAB * sizeof(range_t))) == NULL)
+            unix_error("malloc error in new_range");
+        for (i = 0; i < RANGE_SLAB; i++) {
+            p[i].right = range_pool;
+            range_pool = &p[i];
+        }
+    }
+    p = range_pool;
+    range_pool = p->right;
+
+    /* xorshift32 */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    p->prio = seed;
+    p->left = p->right = NULL;
+    return p;
+}
+
+/*
+ * split_ranges - Split tree t into the ranges below lo and the rest
+ */
+static void split_ranges(range_t *t, char *lo, range_t **below,
+                         range_t **rest)
+{
+    if (t == NULL) {
+        *below = *rest = NULL;
+    } else if (t->lo < lo) {
+        split_ranges(t->right, lo, &t->right, rest);
+        *below = t;
+    } else {
+        split_ranges(t->left, lo, below, &t->left);
+        *rest = t;
+    }
+}
+
+/*
+ * merge_ranges - Join two trees, where every range in a lies below
+ *     every range in b
+ */
+static range_t *merge_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    if (a->prio > b->prio) {
+        a->right = merge_ranges(a->right, b);
+        return a;
+    } else {
+        b->left = merge_ranges(a, b->left);
+        return b;
+    }
+}
+
+/*
+ * insert_range - Insert record p into tree t and return the new root
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    if (t == NULL)
+        return p;
+    if (p->prio > t->prio) {
+        split_ranges(t, p->lo, &p->left, &p->right);
+        return p;
+    }
+    if (p->lo < t->lo)
+        t->left = insert_range(t->left, p);
+    else
+        t->right = insert_range(t->right, p);
+    return t;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    range_t *pred = NULL;  /* the range starting closest below lo... */
+    range_t *succ = NULL;  /* ...and closest at or above it */
 
     assert(size > 0);
 
@@ -615,33 +1320,39 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
+    if(debug_mode == DBG_NONE) return 1;
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
+    /* The payload must not overlap any other payloads. The ranges in
+       the tree are disjoint, so only its neighbours can overlap it. */
+    for (p = *ranges; p != NULL; ) {
+        if (p->lo < lo) {
+            pred = p;
+            p = p->right;
+        } else {
+            succ = p;
+            p = p->left;
         }
     }
+    if (pred != NULL && pred->hi >= lo)
+        p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+        p = succ;
+    if (p != NULL) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, p->lo, p->hi);
+        return 0;
+    }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
 
     return 1;
 }
@@ -651,16 +1362,16 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *pp) != NULL && p->lo != lo)
+        pp = (lo < p->lo) ? &p->left : &p->right;
+
+    if (p != NULL) {
+        *pp = merge_ranges(p->left, p->right);
+        p->right = range_pool;
+        range_pool = p;
     }
 }
 
@@ -669,14 +1380,28 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
+
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->right = range_pool;
+    range_pool = p;
+    *ranges = NULL;
+}
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+/*
+ * check_ranges - Check that every block in the range tree still holds
+ *     its random data
+ */
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r)
+{
+    while (r != NULL) {
+        check_ranges(trace, opnum, r->left);
+        check_index(trace, opnum, r->index);
+        r = r->right;
     }
-    *ranges = NULL;
 }
 
 /**********************************************
@@ -694,46 +1419,123 @@ static void init_random_data(void) {
     }
 }
 
-static void randomize_block(trace_t *traces, int index) {
-    size_t size;
+/*
+ * fill_random - Copy random data into a block, starting at offset base
+ *     into random_data
+ */
+static void fill_random(char *block, size_t size, int base) {
+    size_t pos = (size_t)base % RANDOM_DATA_LEN;
+
+    while (size > 0) {
+        size_t n = RANDOM_DATA_LEN - pos;
+        if (n > size) n = size;
+        memcpy(block, random_data + pos, n);
+        block += n;
+        size -= n;
+        pos = 0;
+    }
+}
+
+/*
+ * same_bytes - Return true if the n bytes at a and b are equal. The
+ *     word loop has no early exit, so gcc vectorizes it.
+ */
+static int same_bytes(const unsigned char *a, const unsigned char *b,
+                      size_t n) {
+    uint64_t diff = 0;
     size_t i;
-    randint_t *block;
-    int base;
 
-    if(debug_mode == DBG_NONE) return;
+    for (i = 0; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        diff |= x ^ y;
+    }
+    for (; i < n; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
 
-    traces->block_rand_base[index] = random();
+/*
+ * check_random - Count the elements of a block that no longer match the
+ *     random data written by fill_random, and report the first one.
+ *     Runs are compared a word at a time; only a run that differs is
+ *     rescanned byte by byte.
+ */
+static int check_random(const char *block, size_t size, int base,
+                        int *firstgarbled) {
+    const randint_t *p = (const randint_t *)block;
+    size_t pos = (size_t)base % RANDOM_DATA_LEN;
+    size_t off = 0;
+    int ngarbled = 0;
+
+    *firstgarbled = -1;
+    while (off < size) {
+        size_t i, n = RANDOM_DATA_LEN - pos;
+        if (n > size - off) n = size - off;
+
+        if (!same_bytes(p + off, random_data + pos, n)) {
+            for (i = 0; i < n; i++) {
+                if (p[off + i] != random_data[pos + i]) {
+                    if (*firstgarbled == -1) *firstgarbled = off + i;
+                    ngarbled++;
+                }
+            }
+        }
+        off += n;
+        pos = 0;
+    }
+    return ngarbled;
+}
+
+/*
+ * block_checksum - Checksum of a block's bytes for -x: the sum and the
+ *     xor of its words, which catches any change to a single word.
+ */
+static uint64_t block_checksum(const char *block, size_t size) {
+    uint64_t sum = 0, x = 0;
+    size_t i;
 
-    block = (randint_t*)traces->blocks[index];
-    size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
+    for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, block + i, sizeof(w));
+        sum += w;
+        x ^= w;
+    }
+    for (; i < size; i++)
+        sum += (uint64_t)(unsigned char)block[i] << (8 * (i % 8));
+    return sum ^ (x << 1 | x >> 63);
+}
+
+static void randomize_block(trace_t *traces, int index) {
+    if(debug_mode == DBG_NONE) return;
 
-    for(i = 0; i < size; i++) {
-        block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
+    traces->block_rand_base[index] = random();
+    fill_random(traces->blocks[index], traces->block_sizes[index],
+                traces->block_rand_base[index]);
+    if (checksum_mode) {
+        traces->block_sums[index].size = traces->block_sizes[index];
+        traces->block_sums[index].sum =
+            block_checksum(traces->blocks[index], traces->block_sizes[index]);
     }
 }
 
 static void check_index(const trace_t *trace, int opnum, int index) {
-    size_t size;
-    size_t i;
-    randint_t *block;
-    int base;
-    int ngarbled = 0;
-    int firstgarbled = -1;
+    int ngarbled;
+    int firstgarbled;
 
     if(index < 0) return; /* we're doing free(NULL) */
     if(debug_mode == DBG_NONE) return;
 
-    block = (randint_t*)trace->blocks[index];
-    size = trace->block_sizes[index] / sizeof(*block);
-    base = trace->block_rand_base[index];
+    /* A matching checksum means there is nothing to locate */
+    if (checksum_mode &&
+        trace->block_sums[index].size == trace->block_sizes[index] &&
+        trace->block_sums[index].sum ==
+        block_checksum(trace->blocks[index], trace->block_sizes[index]))
+        return;
 
-    for(i = 0; i < size; i++) {
-        if(block[i] != random_data[(base + i) % RANDOM_DATA_LEN]) {
-            if(firstgarbled == -1) firstgarbled = i;
-            ngarbled++;
-        }
-    }
+    ngarbled = check_random(trace->blocks[index], trace->block_sizes[index],
+                            trace->block_rand_base[index], &firstgarbled);
     if(ngarbled != 0) {
         malloc_error(trace, opnum, "block %d has %d garbled %s%s, "
                      "starting at byte %zu", index, ngarbled, randint_t_name,
@@ -747,6 +1549,12 @@ static void check_index(const trace_t *trace, int opnum, int index) {
 
 /*
  * read_trace - read a trace file and store it in memory
+ *
+ * A request line may start with @tid, the thread that makes it in the
+ * threaded replay (unprefixed requests are thread 0), and a line "b" is
+ * a barrier: every thread finishes its requests before the barrier
+ * before any thread goes past it. Barriers do not count in num_ops.
+ * The other evaluations replay the requests in file order.
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
@@ -757,6 +1565,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     int index, size;
     int max_index = 0;
     int op_index;
+    int tid;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -765,50 +1574,56 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
+    trace->num_threads = 1;
+    trace->op_tids = NULL;
+    trace->num_barriers = 0;
+    trace->barriers = NULL;
+
     /* Read the trace file header */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
+
+    /* Binary traces are mapped and decoded directly, see bintrace.h */
+    char magic[sizeof(bintrace_hdr_t)];
+    if (bt_is_binary(magic, fread(magic, 1, sizeof(magic), tracefile))) {
+        fclose(tracefile);
+        read_bintrace(trace);
+        goto done;
+    }
+    rewind(tracefile);
+
     int r;
     r = fscanf(tracefile, "%d", &trace->weight);
     r = fscanf(tracefile, "%d", &trace->num_ids);
     r = fscanf(tracefile, "%d", &trace->num_ops);
     r = fscanf(tracefile, "%d", &trace->ignore_ranges);
 
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
-    }
-
     /* We'll store each request line in the trace in this array */
     if ((trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
-
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        if (type[0] == '@') {
+            tid = atoi(type + 1);
+            if (tid < 0 || tid >= MAX_THREADS)
+                app_error("%s: thread id %d out of range\n",
+                          trace->filename, tid);
+            if (trace->op_tids == NULL && (trace->op_tids =
+                 calloc(trace->num_ops, sizeof(int))) == NULL)
+                unix_error("malloc failed in read_trace");
+            trace->op_tids[op_index] = tid;
+            if (tid >= trace->num_threads)
+                trace->num_threads = tid + 1;
+            if (fscanf(tracefile, "%s", type) == EOF)
+                break;
+        }
         switch(type[0]) {
         case 'a':
             r = fscanf(tracefile, "%u %u", &index, &size);
@@ -829,6 +1644,12 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
             break;
+        case 'b':
+            if ((trace->barriers = realloc(trace->barriers,
+                 (trace->num_barriers + 1) * sizeof(int))) == NULL)
+                unix_error("realloc failed in read_trace");
+            trace->barriers[trace->num_barriers++] = op_index;
+            continue;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
                       type[0], trace->filename);
@@ -840,17 +1661,139 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+ done:
+    if(trace->weight < 0 || trace->weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    }
 
-    return trace;
-}
+    /* We'll keep an array of pointers to the allocated blocks here,
+       with one more that stays NULL for replay's free(NULL)... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids + 1, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
 
-/*
- * reinit_trace - get the trace ready for another run.
- */
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* and, with -x, the checksum of that data */
+    trace->block_sums = NULL;
+    if (checksum_mode && (trace->block_sums =
+         calloc(trace->num_ids, sizeof(*trace->block_sums))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+
+    encode_ops(trace);
+
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+
+    return trace;
+}
+
+/*
+ * read_bintrace - Map a binary trace (see bintrace.h) and decode its ops
+ *     straight out of the mapping. There is no text to scan, and the
+ *     header tells us num_ops and num_ids up front.
+ */
+static void read_bintrace(trace_t *trace)
+{
+    int fd;
+    struct stat st;
+    const unsigned char *map, *p, *end;
+    const bintrace_hdr_t *hdr;
+    int i, type, prev_index = 0;
+
+    if ((fd = open(trace->filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        unix_error("Could not open %s in read_bintrace", trace->filename);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED)
+        unix_error("mmap failed in read_bintrace");
+    close(fd);
+
+    hdr = (const bintrace_hdr_t *)map;
+    if (hdr->version != BT_VERSION)
+        app_error("%s: unsupported binary trace version %u\n",
+                  trace->filename, hdr->version);
+    if (sizeof(*hdr) + hdr->ops_bytes > (uint64_t)st.st_size)
+        app_error("%s: binary trace is truncated\n", trace->filename);
+
+    trace->weight = hdr->weight;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->ignore_ranges = hdr->ignore_ranges;
+    if (verbose > 1)
+        printf("Binary trace: %u ops, %u ids, peak %lu live bytes "
+               "in %u blocks\n", hdr->num_ops, hdr->num_ids,
+               (unsigned long)hdr->peak_live_bytes, hdr->peak_live_blocks);
+
+    if ((trace->ops =
+         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc failed in read_bintrace");
+
+    p = map + sizeof(*hdr);
+    end = p + hdr->ops_bytes;
+    for (i = 0; i < trace->num_ops; i++) {
+        p = bt_decode_op(p, end, &type, &trace->ops[i].index,
+                         &trace->ops[i].size, &prev_index);
+        if (p == NULL || trace->ops[i].index < (type == BT_FREE ? -1 : 0) ||
+            trace->ops[i].index >= trace->num_ids)
+            app_error("%s: corrupt op %d in binary trace\n",
+                      trace->filename, i);
+        switch (type) {
+        case BT_ALLOC:   trace->ops[i].type = ALLOC;   break;
+        case BT_FREE:    trace->ops[i].type = FREE;    break;
+        case BT_REALLOC: trace->ops[i].type = REALLOC; break;
+        default:
+            app_error("%s: bogus op type %d in binary trace\n",
+                      trace->filename, type);
+        }
+    }
+    munmap((void *)map, st.st_size);
+}
+
+/*
+ * encode_ops - Lay the ops out for replay as three arrays: 9 bytes an
+ *     op instead of a 16-byte traceop_t, so more of them share a cache
+ *     line. free(NULL) gets the slot past the last id, which is always
+ *     NULL, so replay needs no test for it. op_slot runs PREFETCH_AHEAD
+ *     slots past the last op, so that replay can prefetch without a
+ *     bounds check. Sizes beyond 32 bits fail on the simulated heap
+ *     anyway and are clamped.
+ */
+static void encode_ops(trace_t *trace)
+{
+    int i, n = trace->num_ops;
+
+    if ((trace->op_type = malloc(n + 1)) == NULL ||
+        (trace->op_slot = malloc((n + PREFETCH_AHEAD) * sizeof(uint32_t))) == NULL ||
+        (trace->op_size = malloc((n + 1) * sizeof(uint32_t))) == NULL)
+        unix_error("malloc failed in encode_ops");
+    for (i = 0; i < n; i++) {
+        traceop_t *op = &trace->ops[i];
+        if (op->type != ALLOC && op->type != FREE && op->type != REALLOC)
+            app_error("%s: nonexistent request type at op %d", trace->filename, i);
+        trace->op_type[i] = op->type;
+        trace->op_slot[i] = op->index < 0 ? (uint32_t)trace->num_ids : (uint32_t)op->index;
+        trace->op_size[i] = op->size > UINT32_MAX ? UINT32_MAX : (uint32_t)op->size;
+    }
+    for (; i < n + PREFETCH_AHEAD; i++)
+        trace->op_slot[i] = trace->num_ids;
+}
+
+/*
+ * reinit_trace - get the trace ready for another run.
+ */
 static void reinit_trace(trace_t *trace)
 {
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
@@ -859,7 +1802,7 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
@@ -868,6 +1811,12 @@ static void free_trace(trace_t *trace)
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->block_sums);
+    free(trace->op_tids);
+    free(trace->barriers);
+    free(trace->op_type);
+    free(trace->op_slot);
+    free(trace->op_size);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -905,17 +1854,14 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         size = trace->ops[i].size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-                        
             /* Let the students check their own heap */
-            mm_checkheap(verbose);
+            if (mm_checkheap(LINENUM(i)) > 0) {
+                malloc_error(trace, i, "mm_checkheap found errors");
+                return 0;
+            }
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
@@ -1028,6 +1974,9 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    FILE *timeline = NULL;
+    FILE *snapfile = NULL;
+    int next_snap = 0;
 
     reinit_trace(trace);
 
@@ -1036,6 +1985,13 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
+    if (timeline_ops > 0) {
+        timeline = open_trace_output(trace, ".timeline.csv");
+        fprintf(timeline, "op,live_bytes,heap_bytes,free_bytes,largest_free,util,frag\n");
+    }
+    if (num_snaps > 0)
+        snapfile = open_trace_output(trace, ".heap.bin");
+
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
@@ -1096,22 +2052,145 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (timeline && ((i + 1) % timeline_ops == 0 || i == trace->num_ops - 1))
+            sample_timeline(timeline, i + 1, total_size);
+        while (snapfile && next_snap < num_snaps && snap_ops[next_snap] == i + 1)
+            write_snapshot(snapfile, snap_ops[next_snap++], total_size);
     }
 
+    if (timeline && fclose(timeline) != 0)
+        unix_error("Could not write timeline for %s", trace->filename);
+    if (snapfile && fclose(snapfile) != 0)
+        unix_error("Could not write heap snapshots for %s", trace->filename);
+
     printf(".");
 
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
 
+/*
+ * open_trace_output - Create an output file for a trace in the current
+ *     directory, named after the trace file less any .rep suffix, plus
+ *     suffix. With -a, the allocator's name goes in between, or each
+ *     allocator's run would overwrite the last one's file.
+ */
+static FILE *open_trace_output(const trace_t *trace, const char *suffix)
+{
+    char path[MAXLINE + sizeof(allocator->name) + 16];
+    const char *name = strrchr(trace->filename, '/');
+    size_t len;
+    FILE *fp;
+
+    name = name ? name + 1 : trace->filename;
+    len = strlen(name);
+    if (len > 4 && strcmp(name + len - 4, ".rep") == 0)
+        len -= 4;
+    if (num_allocators > 1)
+        sprintf(path, "%.*s.%s%s", (int)len, name, allocator->name, suffix);
+    else
+        sprintf(path, "%.*s%s", (int)len, name, suffix);
+
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not open %s in open_trace_output", path);
+    return fp;
+}
+
+/*
+ * sample_timeline - Write one row: live payload bytes, heap size, bytes
+ *     in free blocks and the largest free block, as reported by the
+ *     allocator. util is live/heap; frag is the external fragmentation
+ *     1 - largest/free, which is 0 when all free space is one block.
+ */
+static void sample_timeline(FILE *fp, int opnum, int live)
+{
+    size_t free_bytes, largest, heap = mem_heapsize();
+
+    mm_heapstats(&free_bytes, &largest);
+    fprintf(fp, "%d,%d,%zu,%zu,%zu,%.4f,%.4f\n", opnum, live, heap,
+            free_bytes, largest, heap ? (double)live / heap : 0.0,
+            free_bytes ? 1.0 - (double)largest / free_bytes : 0.0);
+}
+
+/* Blocks gathered by snapshot_block for the current snapshot */
+static heapsnap_block_t *snap_blocks = NULL;
+static size_t snap_count, snap_cap;
+
+/*
+ * snapshot_block - mm_heapwalk callback that records one block
+ */
+static void snapshot_block(void *arg __attribute__((unused)), size_t offset,
+                           size_t size, int alloc)
+{
+    if (snap_count == snap_cap) {
+        snap_cap = snap_cap ? 2 * snap_cap : 4096;
+        snap_blocks = realloc(snap_blocks, snap_cap * sizeof(heapsnap_block_t));
+        if (snap_blocks == NULL)
+            unix_error("realloc failed in snapshot_block");
+    }
+    snap_blocks[snap_count].offset = (uint32_t)offset;
+    snap_blocks[snap_count].size = (uint32_t)size | (alloc ? HS_ALLOC : 0);
+    snap_count++;
+}
+
+/*
+ * write_snapshot - Append the current block layout to fp, see heapsnap.h
+ */
+static void write_snapshot(FILE *fp, int opnum, int live)
+{
+    heapsnap_hdr_t hdr;
+
+    snap_count = 0;
+    mm_heapwalk(snapshot_block, NULL);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HS_MAGIC, sizeof(hdr.magic));
+    hdr.version = HS_VERSION;
+    hdr.opnum = opnum;
+    hdr.heap_size = mem_heapsize();
+    hdr.live_bytes = live;
+    hdr.num_blocks = snap_count;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(snap_blocks, sizeof(heapsnap_block_t), snap_count, fp) != snap_count)
+        unix_error("fwrite failed in write_snapshot");
+}
+
+/*
+ * parse_snap_ops - Parse the comma-separated op counts given to -H
+ */
+static void parse_snap_ops(const char *list)
+{
+    const char *p = list;
+    char *end;
+    int i, j, t;
+
+    num_snaps = 0;
+    while (*p) {
+        long op = strtol(p, &end, 10);
+        if (end == p || op <= 0 || (*end != ',' && *end != '\0'))
+            app_error("Bad op list for -H: %s\n", list);
+        if ((snap_ops = realloc(snap_ops, (num_snaps + 1) * sizeof(int))) == NULL)
+            unix_error("realloc failed in parse_snap_ops");
+        snap_ops[num_snaps++] = (int)op;
+        p = *end ? end + 1 : end;
+    }
+
+    /* eval_mm_util walks the list in order */
+    for (i = 1; i < num_snaps; i++)
+        for (j = i; j > 0 && snap_ops[j-1] > snap_ops[j]; j--) {
+            t = snap_ops[j-1];
+            snap_ops[j-1] = snap_ops[j];
+            snap_ops[j] = t;
+        }
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
@@ -1120,40 +2199,910 @@ static void eval_mm_speed(void *ptr)
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
 
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    replay(trace, 0, trace->num_ops);
+}
 
+/*
+ * replay - Interpret trace requests from up to but not including to.
+ *     This is the loop every speed sample times, so it reads the
+ *     arrays from encode_ops, and prefetches the block slot of an op
+ *     PREFETCH_AHEAD ahead: the slots are scattered over blocks[] and
+ *     would otherwise miss for large traces. Types were checked when
+ *     the ops were encoded.
+ */
+static void replay(trace_t *trace, int from, int to)
+{
+    const unsigned char *type = trace->op_type;
+    const uint32_t *slot = trace->op_slot;
+    const uint32_t *size = trace->op_size;
+    char **blocks = trace->blocks;
+    char *p;
+    int i;
+
+    for (i = from;  i < to;  i++) {
+        char **b = &blocks[slot[i]];
+
+        __builtin_prefetch(&blocks[slot[i + PREFETCH_AHEAD]], 1);
+        switch (type[i]) {
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((*b = mm_malloc(size[i])) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            if ((p = mm_realloc(*b, size[i])) == NULL && size[i] != 0)
                 app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
+            *b = p;
             break;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            if(index < 0) {
-                block = 0;
-            } else {
-                block = trace->blocks[index];
+        default: /* FREE: mm_free */
+            mm_free(*b);
+        }
+    }
+}
+
+/*
+ * measure_steady - With -k, time the ops before op k from a fresh heap
+ *     (warm-up), and the ops from k on from the heap as it is at op k
+ *     (steady state). This process replays up to k once and keeps that
+ *     heap as the snapshot; each steady sample forks a child, which
+ *     gets the heap and the allocator's globals copy-on-write and
+ *     replays the rest. The snapshot stays untouched for the next.
+ */
+static void measure_steady(speed_t *params, stats_t *stats)
+{
+    trace_t *trace = params->trace;
+    double lo, hi;
+    int k = steady_pct >= 0 ? (int)(steady_pct / 100 * trace->num_ops)
+                            : steady_op;
+
+    if (k > trace->num_ops)
+        k = trace->num_ops;
+    params->steady_from = stats->steady_from = k;
+
+    if (ci_budget > 0)
+        stats->secs_warmup = fsecs_median(eval_mm_warmup, params, ci_budget,
+                                          &lo, &hi);
+    else
+        stats->secs_warmup = fsecs(eval_mm_warmup, params);
+
+    stats->secs_steady = 0;
+    if (k == trace->num_ops)
+        return;
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in measure_steady");
+    replay(trace, 0, k);
+    fflush(stdout);               /* or every child would print it again */
+    fflush(stderr);
+    if (ci_budget > 0)
+        stats->secs_steady = fsecs_median_timed(eval_mm_steady, params,
+                                                ci_budget, &lo, &hi);
+    else
+        stats->secs_steady = fsecs_timed(eval_mm_steady, params);
+}
+
+/*
+ * eval_mm_warmup - eval_mm_speed, stopping at the snapshot's op
+ */
+static void eval_mm_warmup(void *ptr)
+{
+    speed_t *params = ptr;
+    trace_t *trace = params->trace;
+    reinit_trace(trace);
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_warmup");
+
+    replay(trace, 0, params->steady_from);
+}
+
+/*
+ * eval_mm_steady - One steady-state sample: replay the ops from the
+ *     snapshot's op on in a child, and return the cycles they took
+ */
+static double eval_mm_steady(void *ptr)
+{
+    speed_t *params = ptr;
+    trace_t *trace = params->trace;
+    double cycles = -1;
+    int fd[2], status;
+    pid_t pid;
+
+    if (pipe(fd) < 0)
+        unix_error("pipe failed in eval_mm_steady");
+    if ((pid = fork()) < 0)
+        unix_error("fork failed in eval_mm_steady");
+    if (pid == 0) {
+        close(fd[0]);
+        prefault();
+        fsecs_prepare();
+        start_counter();
+        replay(trace, params->steady_from, trace->num_ops);
+        cycles = get_counter();
+        if (write(fd[1], &cycles, sizeof(cycles)) != sizeof(cycles))
+            _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if (read(fd[0], &cycles, sizeof(cycles)) != sizeof(cycles))
+        cycles = -1;
+    close(fd[0]);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || cycles < 0)
+        app_error("%s: steady-state run failed", trace->filename);
+    return cycles;
+}
+
+/*
+ * prefault - Write to every resident page of this process's private
+ *     writable mappings (memlib's heap is write-only, -w-p in maps).
+ *     After fork they are shared copy-on-write with the parent, and the
+ *     first write to each would otherwise take a fault and a page copy
+ *     inside the timed run. Pages that are not resident stay that way;
+ *     they would fault in the parent too.
+ */
+static void prefault(void)
+{
+    FILE *fp;
+    char line[1024], perms[8];
+    unsigned long lo, hi, i, n;
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char *vec = NULL;
+    unsigned long cap = 0;
+
+    if ((fp = fopen("/proc/self/maps", "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx %7s", &lo, &hi, perms) != 3 ||
+            perms[1] != 'w' || perms[3] != 'p' || strstr(line, "[v") != NULL)
+            continue;             /* [vvar] and [vsyscall] belong to the kernel */
+        n = (hi - lo) / page;
+        if (n > cap) {
+            if ((vec = realloc(vec, n)) == NULL)
+                break;
+            cap = n;
+        }
+        if (mincore((void *)lo, hi - lo, vec) < 0)
+            continue;
+        for (i = 0; i < n; i++)
+            if (vec[i] & 1) {
+                volatile char *p = (char *)lo + i * page;
+                *p = *p;
             }
-            mm_free(block);
+    }
+    free(vec);
+    fclose(fp);
+}
+
+/*
+ * monotonic_secs - CLOCK_MONOTONIC in seconds
+ */
+static double monotonic_secs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/*
+ * replay_thread - Replay one thread's requests, waiting at each barrier
+ *     for the other threads and before each request for the id's
+ *     earlier requests, wherever they are.
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_thread_t *t = ptr;
+    replay_t *r = t->replay;
+    trace_t *trace = r->trace;
+    int k, i, index, spins;
+    char *p;
+
+    pthread_barrier_wait(&r->barrier);
+    t->begin = monotonic_secs();
+    for (k = 0; k < t->len; k++) {
+        if ((i = t->stream[k]) < 0) {
+            pthread_barrier_wait(&r->barrier);
+            continue;
+        }
+        index = trace->ops[i].index;
+        spins = 0;
+        if (index >= 0)
+            while (__atomic_load_n(&r->done[index], __ATOMIC_ACQUIRE) != r->seq[i])
+                if (++spins % 64 == 0)
+                    sched_yield();
+
+        pthread_mutex_lock(&r->lock);
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                app_error("mm_malloc error in eval_mm_threads");
+            trace->blocks[index] = p;
+            break;
+        case REALLOC:
+            p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+            if (p == NULL && trace->ops[i].size != 0)
+                app_error("mm_realloc error in eval_mm_threads");
+            trace->blocks[index] = p;
+            break;
+        case FREE:
+            mm_free(index < 0 ? NULL : trace->blocks[index]);
+            break;
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        if (index >= 0)
+            __atomic_store_n(&r->done[index], r->seq[i] + 1, __ATOMIC_RELEASE);
+    }
+    t->end = monotonic_secs();
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay the trace on trace->num_threads threads,
+ *     THREAD_RUNS times, and keep the per-thread times of the run with
+ *     the shortest wall time.
+ */
+static void eval_mm_threads(trace_t *trace, thread_stats_t *ts)
+{
+    int n = trace->num_threads;
+    replay_t r;
+    replay_thread_t *t;
+    pthread_t *tids;
+    int *count;
+    int i, j, b, run;
+
+    r.trace = trace;
+    t = calloc(n, sizeof(*t));
+    tids = calloc(n, sizeof(*tids));
+    r.seq = malloc(trace->num_ops * sizeof(int));
+    r.done = malloc(trace->num_ids * sizeof(int));
+    count = calloc(trace->num_ids, sizeof(int));
+    if (t == NULL || tids == NULL || r.seq == NULL || r.done == NULL ||
+        count == NULL)
+        unix_error("malloc failed in eval_mm_threads");
+
+    /* Number each id's requests, and split the ops among the threads */
+    for (j = 0; j < n; j++) {
+        t[j].replay = &r;
+        if ((t[j].stream = malloc((trace->num_ops + trace->num_barriers) *
+                                  sizeof(int))) == NULL)
+            unix_error("malloc failed in eval_mm_threads");
+    }
+    for (i = 0, b = 0; i <= trace->num_ops; i++) {
+        for (; b < trace->num_barriers && trace->barriers[b] <= i; b++)
+            for (j = 0; j < n; j++)
+                t[j].stream[t[j].len++] = -1;
+        if (i == trace->num_ops)
+            break;
+        if (trace->ops[i].index >= 0)
+            r.seq[i] = count[trace->ops[i].index]++;
+        j = trace->op_tids ? trace->op_tids[i] : 0;
+        t[j].stream[t[j].len++] = i;
+        t[j].ops++;
+    }
+    free(count);
+
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_barrier_init(&r.barrier, NULL, n);
+    ts->threads = n;
+    ts->wall = DBL_MAX;
+    for (run = 0; run < THREAD_RUNS; run++) {
+        double begin = DBL_MAX, end = 0;
+
+        reinit_trace(trace);
+        memset(r.done, 0, trace->num_ids * sizeof(int));
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_threads");
+
+        for (j = 0; j < n; j++)
+            if (pthread_create(&tids[j], NULL, replay_thread, &t[j]) != 0)
+                app_error("pthread_create failed in eval_mm_threads");
+        for (j = 0; j < n; j++) {
+            pthread_join(tids[j], NULL);
+            if (t[j].begin < begin)
+                begin = t[j].begin;
+            if (t[j].end > end)
+                end = t[j].end;
+        }
+        if (end - begin < ts->wall) {
+            ts->wall = end - begin;
+            for (j = 0; j < n; j++) {
+                ts->ops[j] = t[j].ops;
+                ts->secs[j] = t[j].end - t[j].begin;
+            }
+        }
+    }
+    pthread_barrier_destroy(&r.barrier);
+    pthread_mutex_destroy(&r.lock);
+
+    for (j = 0; j < n; j++)
+        free(t[j].stream);
+    free(t);
+    free(tids);
+    free(r.seq);
+    free(r.done);
+}
+
+/*
+ * print_threads - Print the throughput of each thread and of the whole
+ *     threaded replay, as one write like print_latency.
+ */
+static void print_threads(const trace_t *trace, const thread_stats_t *ts)
+{
+    char buf[8192];
+    int len = 0;
+    int j;
+
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "\nThreaded replay of %s (%d threads, %d barriers):\n"
+                    "  %-8s%10s%10s%10s\n", trace->filename, ts->threads,
+                    trace->num_barriers, "thread", "ops", "secs", "Kops");
+    for (j = 0; j < ts->threads; j++)
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        "  %-8d%10d%10.6f%10.0f\n", j, ts->ops[j],
+                        ts->secs[j], ts->secs[j] > 0 ?
+                        ts->ops[j] / 1e3 / ts->secs[j] : 0.0);
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "  %-8s%10d%10.6f%10.0f\n", "all", trace->num_ops,
+                    ts->wall, ts->wall > 0 ?
+                    trace->num_ops / 1e3 / ts->wall : 0.0);
+    fputs(buf, stdout);
+}
+
+/*****************************************************************
+ * The following routines replay a trace in streaming mode (-S).
+ * Driver memory is proportional to the live set, not the trace, so
+ * this works for traces far larger than RAM. Correctness, space
+ * utilization and time are all measured in a single pass.
+ ****************************************************************/
+
+/*
+ * stream_read_op - Parse the next op of a streamed trace into op.
+ *     Text traces use the same fscanf loop as read_trace; binary traces
+ *     are decoded out of a read buffer that is refilled as it drains.
+ */
+static void stream_read_op(stream_t *st, traceop_t *op)
+{
+    trace_t *trace = st->trace;
+    int type;
+
+    if (st->fp == NULL) {
+        if (st->buf_len - st->buf_pos < BT_MAX_OP_BYTES) {
+            ssize_t n;
+            memmove(st->buf, st->buf + st->buf_pos, st->buf_len - st->buf_pos);
+            st->buf_len -= st->buf_pos;
+            st->buf_pos = 0;
+            while (st->buf_len < STREAM_BUF &&
+                   (n = read(st->fd, st->buf + st->buf_len,
+                             STREAM_BUF - st->buf_len)) > 0)
+                st->buf_len += n;
+        }
+        const unsigned char *p = st->buf + st->buf_pos;
+        const unsigned char *q = bt_decode_op(p, st->buf + st->buf_len, &type,
+                                              &op->index, &op->size,
+                                              &st->prev_index);
+        if (q == NULL)
+            app_error("%s: binary trace is truncated\n", trace->filename);
+        st->buf_pos += q - p;
+        op->type = type == BT_ALLOC ? ALLOC : type == BT_FREE ? FREE : REALLOC;
+    } else {
+        char type[MAXLINE];
+        int n = 1;
+
+        /* Streaming replays a threaded trace in file order */
+        do {
+            if (fscanf(st->fp, "%1023s", type) != 1)
+                app_error("%s: trace ends early\n", trace->filename);
+        } while (type[0] == '@' || type[0] == 'b');
+        /* As in read_trace, a missing size repeats the previous one */
+        switch(type[0]) {
+        case 'a':
+            op->type = ALLOC;
+            n = fscanf(st->fp, "%d %u", &op->index, &st->last_size);
+            break;
+        case 'r':
+            op->type = REALLOC;
+            n = fscanf(st->fp, "%d %u", &op->index, &st->last_size);
+            break;
+        case 'f':
+            op->type = FREE;
+            n = fscanf(st->fp, "%d", &op->index);
+            break;
+        default:
+            app_error("Bogus type character (%c) in tracefile %s\n",
+                      type[0], trace->filename);
+        }
+        if (n < 1)
+            app_error("%s: malformed request line\n", trace->filename);
+        op->size = op->type == FREE ? 0 : st->last_size;
+    }
+    if (op->index < -1 || op->index >= trace->num_ids ||
+        (op->index < 0 && op->type != FREE))
+        app_error("%s: block id %d out of range\n", trace->filename, op->index);
+}
+
+/*
+ * stream_reader - Reader thread: fill the two chunks in turn, waiting
+ *     for the driver to finish replaying a chunk before refilling it.
+ */
+static void *stream_reader(void *arg)
+{
+    stream_t *st = arg;
+    int b = 0;
+
+    for (;;) {
+        chunk_t *c = &st->chunks[b];
+
+        pthread_mutex_lock(&st->lock);
+        while (c->full)
+            pthread_cond_wait(&st->cond, &st->lock);
+        pthread_mutex_unlock(&st->lock);
+
+        for (c->n = 0; c->n < STREAM_CHUNK && st->ops_left > 0; c->n++) {
+            stream_read_op(st, &c->ops[c->n]);
+            st->ops_left--;
+        }
+
+        pthread_mutex_lock(&st->lock);
+        c->full = 1;
+        pthread_cond_broadcast(&st->cond);
+        pthread_mutex_unlock(&st->lock);
+
+        if (c->n == 0)
+            return NULL;
+        b ^= 1;
+    }
+}
+
+/*
+ * live_find - Return the slot holding block id index, or the empty
+ *     slot where it would go. Linear probing; the table is never more
+ *     than half full.
+ */
+static live_t *live_find(livemap_t *map, int index)
+{
+    size_t i = ((unsigned)index * 2654435761u) & map->mask;
+
+    while (map->slots[i].index != -1 && map->slots[i].index != index)
+        i = (i + 1) & map->mask;
+    return &map->slots[i];
+}
+
+/*
+ * live_resize - Rehash the live table into nslots slots
+ */
+static void live_resize(livemap_t *map, size_t nslots)
+{
+    live_t *old = map->slots;
+    size_t i, oldslots = map->slots ? map->mask + 1 : 0;
+
+    if ((map->slots = malloc(nslots * sizeof(live_t))) == NULL)
+        unix_error("malloc failed in live_resize");
+    for (i = 0; i < nslots; i++)
+        map->slots[i].index = -1;
+    map->mask = nslots - 1;
+    for (i = 0; i < oldslots; i++)
+        if (old[i].index != -1)
+            *live_find(map, old[i].index) = old[i];
+    free(old);
+}
+
+/*
+ * live_insert - Add (or overwrite) the entry for block id index
+ */
+static live_t *live_insert(livemap_t *map, int index)
+{
+    live_t *e;
+
+    if (2 * (map->count + 1) > map->mask + 1)
+        live_resize(map, 2 * (map->mask + 1));
+    e = live_find(map, index);
+    if (e->index == -1) {
+        e->index = index;
+        map->count++;
+    }
+    return e;
+}
+
+/*
+ * live_remove - Drop a block from the live table. Entries after it in
+ *     the same probe run are shifted back, so no tombstones are needed.
+ */
+static void live_remove(livemap_t *map, live_t *e)
+{
+    size_t i = e - map->slots;
+    size_t j = i;
+
+    map->count--;
+    for (;;) {
+        size_t home;
+
+        map->slots[i].index = -1;
+        do {
+            j = (j + 1) & map->mask;
+            if (map->slots[j].index == -1)
+                return;
+            home = ((unsigned)map->slots[j].index * 2654435761u) & map->mask;
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        map->slots[i] = map->slots[j];
+        i = j;
+    }
+}
+
+/*
+ * stream_check - Verify that a live block still holds its random data
+ */
+static void stream_check(const trace_t *trace, int opnum, const live_t *e,
+                         size_t size)
+{
+    int ngarbled, firstgarbled;
+
+    if (debug_mode == DBG_NONE) return;
+
+    if (checksum_mode && size == e->size &&
+        e->sum == block_checksum(e->p, size))
+        return;
+
+    ngarbled = check_random(e->p, size, e->rand_base, &firstgarbled);
+    if (ngarbled != 0) {
+        malloc_error(trace, opnum, "block %d has %d garbled %s%s, "
+                     "starting at byte %zu", e->index, ngarbled, randint_t_name,
+                     ngarbled > 1 ? "s" : "", sizeof(randint_t) * firstgarbled);
+    }
+}
+
+/*
+ * stream_randomize - Fill a live block with fresh random data
+ */
+static void stream_randomize(live_t *e)
+{
+    if (debug_mode == DBG_NONE) return;
+
+    e->rand_base = random();
+    fill_random(e->p, e->size, e->rand_base);
+    if (checksum_mode)
+        e->sum = block_checksum(e->p, e->size);
+}
+
+/*
+ * stream_replay_op - Replay one op against the mm package, with the same
+ *     checks eval_mm_valid makes. Returns 0 if the allocator misbehaved.
+ */
+static int stream_replay_op(trace_t *trace, livemap_t *live, range_t **ranges,
+                            const traceop_t *op, int opnum, long *total_size)
+{
+    live_t *e = NULL;
+    char *p, *oldp = NULL;
+    size_t oldsize = 0;
+
+    if (op->index >= 0 && op->type != ALLOC) {
+        e = live_find(live, op->index);
+        if (e->index == -1) {
+            e = NULL;
+        } else {
+            oldp = e->p;
+            oldsize = e->size;
+            stream_check(trace, opnum, e, oldsize);
+        }
+    }
+
+    switch (op->type) {
+    case ALLOC:
+        if ((p = mm_malloc(op->size)) == NULL) {
+            malloc_error(trace, opnum, "mm_malloc failed.");
+            return 0;
+        }
+        if (add_range(ranges, p, op->size, trace, opnum, op->index) == 0)
+            return 0;
+        e = live_insert(live, op->index);
+        e->p = p;
+        e->size = op->size;
+        stream_randomize(e);
+        *total_size += op->size;
+        break;
+
+    case REALLOC:
+        p = mm_realloc(oldp, op->size);
+        if (p == NULL && op->size != 0) {
+            malloc_error(trace, opnum, "mm_realloc failed.");
+            return 0;
+        }
+        if (p != NULL && op->size == 0) {
+            malloc_error(trace, opnum, "mm_realloc with size 0 returned "
+                         "non-NULL.");
+            return 0;
+        }
+        if (oldp != NULL)
+            remove_range(ranges, oldp);
+        *total_size += (long)op->size - (long)oldsize;
+        if (op->size == 0) {
+            if (e != NULL)
+                live_remove(live, e);
+            break;
+        }
+        if (add_range(ranges, p, op->size, trace, opnum, op->index) == 0)
+            return 0;
+        if (e == NULL)
+            e = live_insert(live, op->index);
+        e->p = p;
+        stream_check(trace, opnum, e, op->size < oldsize ? op->size : oldsize);
+        e->size = op->size;
+        stream_randomize(e);
+        break;
+
+    case FREE:
+        if (oldp != NULL) {
+            remove_range(ranges, oldp);
+            *total_size -= oldsize;
+        }
+        mm_free(oldp);
+        if (e != NULL)
+            live_remove(live, e);
+        break;
+
+    default:
+        app_error("Nonexistent request type in stream_replay_op");
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_stream - Replay a trace of any length in a single streaming
+ *     pass, filling in all of stats. Only the time spent replaying
+ *     chunks is counted in secs; waiting for the reader is not.
+ */
+static void eval_mm_stream(stats_t *stats, const char *tracedir,
+                           const char *filename, range_t **ranges)
+{
+    trace_t trace;
+    stream_t st;
+    livemap_t live;
+    pthread_t reader;
+    struct timespec t0, t1;
+    long total_size = 0, max_total_size = 0;
+    size_t max_live = 0;
+    double secs = 0;
+    int valid = 1;
+    int opnum = 0;
+    int b = 0;
+
+    memset(&trace, 0, sizeof(trace));
+    memset(&st, 0, sizeof(st));
+    snprintf(trace.filename, MAXLINE, "%s%s", tracedir, filename);
+    strcpy(stats->filename, trace.filename);
+    st.trace = &trace;
+
+    if (verbose > 1)
+        printf("Streaming tracefile: %s\n", filename);
+
+    /* Read the header, text or binary */
+    if ((st.fd = open(trace.filename, O_RDONLY)) < 0)
+        unix_error("Could not open %s in eval_mm_stream", trace.filename);
+    if ((st.buf = malloc(STREAM_BUF)) == NULL)
+        unix_error("malloc failed in eval_mm_stream");
+    ssize_t n = read(st.fd, st.buf, sizeof(bintrace_hdr_t));
+    if (n > 0 && bt_is_binary(st.buf, n)) {
+        bintrace_hdr_t hdr;
+        memcpy(&hdr, st.buf, sizeof(hdr));
+        if (hdr.version != BT_VERSION)
+            app_error("%s: unsupported binary trace version %u\n",
+                      trace.filename, hdr.version);
+        trace.weight = hdr.weight;
+        trace.num_ids = hdr.num_ids;
+        trace.num_ops = hdr.num_ops;
+        trace.ignore_ranges = hdr.ignore_ranges;
+    } else {
+        if (lseek(st.fd, 0, SEEK_SET) < 0 ||
+            (st.fp = fdopen(st.fd, "r")) == NULL)
+            unix_error("fdopen failed in eval_mm_stream");
+        if (fscanf(st.fp, "%d %d %d %d", &trace.weight, &trace.num_ids,
+                   &trace.num_ops, &trace.ignore_ranges) != 4)
+            app_error("%s: bad trace header\n", trace.filename);
+    }
+    if(trace.weight < 0 || trace.weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace.filename);
+    }
+    stats->weight = trace.weight;
+    stats->ops = trace.num_ops;
+    st.ops_left = trace.num_ops;
+
+    if ((st.chunks = calloc(2, sizeof(chunk_t))) == NULL)
+        unix_error("calloc failed in eval_mm_stream");
+    pthread_mutex_init(&st.lock, NULL);
+    pthread_cond_init(&st.cond, NULL);
+
+    memset(&live, 0, sizeof(live));
+    live_resize(&live, 1024);
+
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+        malloc_error(&trace, 0, "mm_init failed.");
+        valid = 0;
+    }
+
+    if (pthread_create(&reader, NULL, stream_reader, &st) != 0)
+        app_error("pthread_create failed in eval_mm_stream\n");
+
+    for (;;) {
+        chunk_t *c = &st.chunks[b];
+        int i;
+
+        pthread_mutex_lock(&st.lock);
+        while (!c->full)
+            pthread_cond_wait(&st.cond, &st.lock);
+        pthread_mutex_unlock(&st.lock);
+        if (c->n == 0)
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < c->n && valid; i++, opnum++) {
+            valid = stream_replay_op(&trace, &live, ranges, &c->ops[i],
+                                     opnum, &total_size);
+            if (total_size > max_total_size)
+                max_total_size = total_size;
+            if (live.count > max_live)
+                max_live = live.count;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs += (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+
+        /* Hand the chunk back; after an error, just drain the reader */
+        pthread_mutex_lock(&st.lock);
+        c->full = 0;
+        pthread_cond_broadcast(&st.cond);
+        pthread_mutex_unlock(&st.lock);
+        b ^= 1;
+    }
+    pthread_join(reader, NULL);
+
+    printf(".");
+    stats->valid = valid;
+    stats->secs = secs;
+    stats->util = valid ? (double)max_total_size / (double)mem_heapsize() : 0;
+    if (verbose > 1)
+        printf("peak %zu live blocks, peak %ld live bytes\n",
+               max_live, max_total_size);
+
+    clear_ranges(ranges);
+    if (st.fp != NULL)
+        fclose(st.fp);
+    else
+        close(st.fd);
+    free(st.buf);
+    free(st.chunks);
+    free(live.slots);
+    pthread_mutex_destroy(&st.lock);
+    pthread_cond_destroy(&st.cond);
+}
+
+/*
+ * lat_class - Size class of a request for the latency histograms.
+ *     Size 0, from free(NULL) and realloc(p, 0), goes in the smallest.
+ */
+static int lat_class(size_t size)
+{
+    int c = 0;
+
+    if (size == 0)
+        return 0;
+    for (size = (size - 1) >> 6; size > 0 && c < LAT_CLASSES - 1; size >>= 3)
+        c++;
+    return c;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once, timing each mm_malloc, mm_free
+ *     and mm_realloc call with the serialized cycle counter. The timer's
+ *     own overhead is subtracted from every sample.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *lat)
+{
+    int i, t, c, index;
+    size_t size;
+    char *p;
+    unsigned long long t0, t1, ovhd, cyc;
+
+    memset(lat, 0, sizeof(*lat));
+    ovhd = lathist_timer_overhead();
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            t0 = tsc_begin();
+            p = mm_malloc(size);
+            t1 = tsc_end();
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            p = trace->blocks[index];
+            t0 = tsc_begin();
+            p = mm_realloc(p, size);
+            t1 = tsc_end();
+            if (p == NULL && size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+            p = index < 0 ? NULL : trace->blocks[index];
+            size = index < 0 ? 0 : trace->block_sizes[index];
+            t0 = tsc_begin();
+            mm_free(p);
+            t1 = tsc_end();
             break;
 
         default:
-            app_error("Nonexistent request type in eval_mm_speed");
+            app_error("Nonexistent request type in eval_mm_latency");
         }
+
+        t = trace->ops[i].type;
+        c = lat_class(size);
+        cyc = t1 - t0;
+        lathist_add(&lat->hist[t][c], cyc > ovhd ? cyc - ovhd : 0);
+    }
+}
+
+/*
+ * print_latency - Print p50/p99/p99.9/max cycles per request type and
+ *     size class. The table is built first and written in one go, so
+ *     tables from -j workers do not interleave.
+ */
+static void print_latency(const char *filename, const latency_t *lat)
+{
+    static const char *type_names[3];
+    char buf[8192];
+    int len = 0;
+    int t, c;
+
+    type_names[ALLOC] = "malloc";
+    type_names[FREE] = "free";
+    type_names[REALLOC] = "realloc";
+
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "\nLatency in cycles for %s:\n"
+                    "  %-8s%-7s%9s%9s%9s%9s%11s\n", filename,
+                    "request", "size", "count", "p50", "p99", "p99.9", "max");
+    for (t = 0; t < 3; t++) {
+        lathist_t all;
+        lathist_clear(&all);
+        for (c = 0; c <= LAT_CLASSES; c++) {
+            const lathist_t *h = &lat->hist[t][c];
+            if (c == LAT_CLASSES)
+                h = &all;
+            else
+                lathist_merge(&all, h);
+            if (h->count == 0)
+                continue;
+            len += snprintf(buf + len, sizeof(buf) - len,
+                            "  %-8s%-7s%9llu%9llu%9llu%9llu%11llu\n",
+                            type_names[t],
+                            c == LAT_CLASSES ? "all" : lat_class_names[c],
+                            h->count,
+                            lathist_percentile(h, 0.50),
+                            lathist_percentile(h, 0.99),
+                            lathist_percentile(h, 0.999),
+                            h->max);
+        }
+    }
+    fputs(buf, stdout);
 }
 
 /*
@@ -1276,8 +3225,16 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s %5s%8s%9s", "valid", "util", "ops", "secs", "Kops");
+    if (ci_budget > 0)
+        printf("%17s", "95% CI");
+    if (warm_mode)
+        printf("%7s", "warm");
+    if (steady_mode)
+        printf("%7s%7s", "warmup", "steady");
+    if (null_mode)
+        printf("%7s%7s", "drv ns", "net");
+    printf("  %s\n", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1319,6 +3276,46 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             else
                 printf("%8s%10s%6s", "--", "--", "--");
 
+            /* the interval of Kops is the other way round from secs */
+            if (ci_budget > 0 && stats[i].secs_lo > 0 &&
+                stats[i].weight != WUTIL)
+                printf("  [%6.0f,%6.0f]", (stats[i].ops/1e3)/stats[i].secs_hi,
+                       (stats[i].ops/1e3)/stats[i].secs_lo);
+            else if (ci_budget > 0)
+                printf("%17s", "");
+
+            if (warm_mode && stats[i].secs_warm > 0 &&
+                stats[i].weight != WUTIL)
+                printf("%7.0f", (stats[i].ops/1e3)/stats[i].secs_warm);
+            else if (warm_mode)
+                printf("%7s", "--");
+
+            /* Kops on either side of the snapshot */
+            if (steady_mode && stats[i].weight != WUTIL) {
+                if (stats[i].steady_from > 0 && stats[i].secs_warmup > 0)
+                    printf("%7.0f", (stats[i].steady_from/1e3)/stats[i].secs_warmup);
+                else
+                    printf("%7s", "--");
+                if (stats[i].secs_steady > 0)
+                    printf("%7.0f", ((stats[i].ops - stats[i].steady_from)/1e3)
+                           /stats[i].secs_steady);
+                else
+                    printf("%7s", "--");
+            } else if (steady_mode)
+                printf("%7s%7s", "--", "--");
+
+            /* driver ns per op, and Kops with those taken out */
+            if (null_mode && stats[i].secs_null > 0 &&
+                stats[i].weight != WUTIL) {
+                printf("%7.1f", stats[i].secs_null / stats[i].ops * 1e9);
+                if (stats[i].secs > stats[i].secs_null)
+                    printf("%7.0f", (stats[i].ops/1e3)
+                           /(stats[i].secs - stats[i].secs_null));
+                else
+                    printf("%7s", "--");
+            } else if (null_mode)
+                printf("%7s%7s", "--", "--");
+
             printf(" %s\n", stats[i].filename);
 
             if(stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1334,13 +3331,17 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 }
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
+            printf("%2s%4s %6s%8s%10s%6s%s%s%s%s %s\n",
                    stats[i].weight != 0 ? "*" : "",
                    "no",
                    "-",
                    "-",
                    "-",
                    "-",
+                   ci_budget > 0 ? "                 " : "",
+                   warm_mode ? "      -" : "",
+                   steady_mode ? "      -      -" : "",
+                   null_mode ? "      -      -" : "",
                    stats[i].filename);
         }
     }
@@ -1384,6 +3385,306 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * compare_allocators - Print util and Kops side by side for every
+ *     allocator on every trace. The totals are the mean util and the
+ *     overall Kops of the traces the allocator ran correctly, regardless
+ *     of trace weights.
+ */
+static void compare_allocators(int n, stats_t **stats)
+{
+    int i, k;
+
+    printf("\nComparison of allocators (util, Kops):\n  %-20s", "trace");
+    for (k = 0; k < num_allocators; k++)
+        printf("%16.15s", allocators[k].name);
+    printf("\n");
+
+    for (i = 0; i <= n; i++) {
+        const char *name;
+
+        if (i < n) {
+            name = strrchr(stats[0][i].filename, '/');
+            name = name ? name + 1 : stats[0][i].filename;
+        } else {
+            name = "all";
+        }
+        printf("  %-20.20s", name);
+        for (k = 0; k < num_allocators; k++) {
+            double util = 0, ops = 0, secs = 0;
+            int j, valid = 0;
+
+            for (j = (i < n ? i : 0); j < (i < n ? i + 1 : n); j++) {
+                if (!stats[k][j].valid)
+                    continue;
+                valid++;
+                util += stats[k][j].util;
+                ops += stats[k][j].ops;
+                secs += stats[k][j].secs;
+            }
+            if (valid == 0)
+                printf("%16s", "-");
+            else
+                printf("%8.0f%%%7.0f", 100.0 * util / valid,
+                       secs > 0 ? ops / 1e3 / secs : 0.0);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * printcounters - Print the hardware counts of each trace divided by
+ *     its number of ops, plus instructions per cycle
+ */
+static void printcounters(int n, const stats_t *stats)
+{
+    int i, c;
+
+    printf("\nHardware counters per op:\n ");
+    for (c = 0; c < PC_NUM; c++)
+        printf("%10s", perfctr_name(c));
+    printf("%6s  %s\n", "IPC", "trace");
+
+    for (i = 0; i < n; i++) {
+        const perfctr_t *pc = &stats[i].ctr;
+
+        if (!stats[i].counted || stats[i].ops == 0)
+            continue;
+        printf(" ");
+        for (c = 0; c < PC_NUM; c++) {
+            if (pc->valid[c])
+                printf("%10.2f", pc->count[c] / stats[i].ops);
+            else
+                printf("%10s", "-");
+        }
+        if (pc->valid[PC_INSTR] && pc->valid[PC_CYCLES] && pc->count[PC_CYCLES] > 0)
+            printf("%6.2f", pc->count[PC_INSTR] / pc->count[PC_CYCLES]);
+        else
+            printf("%6s", "-");
+        printf("  %s\n", stats[i].filename);
+    }
+}
+
+/*
+ * Regressions are judged against the timing noise that fcyc measured
+ * for both runs: the K-best spread, or with -I the half-width of the
+ * median's interval. Either can understate the variation between
+ * separate runs, so the tolerance never drops below REGRESS_MIN_TOL.
+ * Utilization is deterministic, so any drop beyond rounding counts.
+ */
+#define REGRESS_MIN_TOL  0.05
+#define REGRESS_UTIL_TOL 0.001
+
+/*
+ * kops - Throughput of one trace in Kops, or 0 if not measured
+ */
+static double kops(const stats_t *stats)
+{
+    return (stats->valid && stats->secs > 0) ? stats->ops / 1e3 / stats->secs : 0;
+}
+
+/*
+ * write_results - Write the per-trace results to filename: CSV if the
+ *     name ends in ".csv", JSON otherwise. The JSON has one trace per
+ *     line so that read_baseline can pick it apart without a parser.
+ */
+static void write_results(const char *filename, int n, const stats_t *stats,
+                          double util, double tput, double perfindex)
+{
+    FILE *fp;
+    int i, csv;
+    size_t len = strlen(filename);
+    const char *q;
+
+    csv = len > 4 && strcmp(filename + len - 4, ".csv") == 0;
+    if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("Could not open %s in write_results", filename);
+
+    if (csv)
+        fprintf(fp, "trace,valid,weight,util,ops,secs,kops,noise,"
+                "secs_lo,secs_hi,secs_warm,steady_from,secs_warmup,secs_steady,"
+                "secs_null\n");
+    else
+        fprintf(fp, "{\n  \"errors\": %d, \"util\": %.6f, \"kops\": %.3f, "
+                "\"perfindex\": %.2f,\n  \"traces\": [\n",
+                errors, util, tput / 1e3, perfindex);
+
+    for (i = 0; i < n; i++) {
+        /* trace names are quoted, with CSV doubling and JSON escaping */
+        fputs(csv ? "\"" : "    {\"trace\": \"", fp);
+        for (q = stats[i].filename; *q; q++) {
+            if (*q == '"')
+                fputs(csv ? "\"\"" : "\\\"", fp);
+            else if (*q == '\\' && !csv)
+                fputs("\\\\", fp);
+            else
+                fputc(*q, fp);
+        }
+        fprintf(fp, csv ? "\",%d,%d,%.6f,%.0f,%.9f,%.3f,%.6f,%.9f,%.9f,%.9f,%d,%.9f,%.9f,%.9f\n"
+                : "\", \"valid\": %d, \"weight\": %d, \"util\": %.6f, "
+                "\"ops\": %.0f, \"secs\": %.9f, \"kops\": %.3f, "
+                "\"noise\": %.6f, \"secs_lo\": %.9f, \"secs_hi\": %.9f, "
+                "\"secs_warm\": %.9f, \"steady_from\": %d, "
+                "\"secs_warmup\": %.9f, \"secs_steady\": %.9f, "
+                "\"secs_null\": %.9f}",
+                stats[i].valid, stats[i].weight, stats[i].util,
+                stats[i].ops, stats[i].secs, kops(&stats[i]), stats[i].noise,
+                stats[i].secs_lo, stats[i].secs_hi, stats[i].secs_warm,
+                stats[i].steady_from, stats[i].secs_warmup, stats[i].secs_steady,
+                stats[i].secs_null);
+        if (!csv)
+            fputs(i < n - 1 ? ",\n" : "\n", fp);
+    }
+    if (!csv)
+        fprintf(fp, "  ]\n}\n");
+    if (fclose(fp) != 0)
+        unix_error("Could not write %s in write_results", filename);
+}
+
+/*
+ * json_field - Parse the number following "key": on a line, or 0
+ */
+static double json_field(const char *line, const char *key)
+{
+    char pat[32];
+    const char *p;
+
+    sprintf(pat, "\"%s\":", key);
+    if ((p = strstr(line, pat)) == NULL)
+        return 0;
+    return atof(p + strlen(pat));
+}
+
+/*
+ * read_baseline - Read the traces from a file written by write_results.
+ *     Returns the number read into *stats, which the caller frees.
+ */
+static int read_baseline(const char *filename, stats_t **stats)
+{
+    FILE *fp;
+    char line[2 * MAXLINE + 256];
+    int n = 0, max = 0, csv = -1;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        unix_error("Could not open %s in read_baseline", filename);
+    *stats = NULL;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        const char *p = line, *rest;
+        char *f;
+        int j = 0;
+        stats_t *s;
+
+        /* the first line tells the two formats apart */
+        if (csv < 0) {
+            csv = strncmp(line, "trace,", 6) == 0;
+            continue;
+        }
+        while (*p == ' ')
+            p++;
+        if (csv ? *p != '"' : strncmp(p, "{\"trace\": \"", 11) != 0)
+            continue;
+        p += csv ? 1 : 11;
+
+        if (n == max) {
+            max = max ? 2 * max : 16;
+            if ((*stats = realloc(*stats, max * sizeof(stats_t))) == NULL)
+                unix_error("realloc failed in read_baseline");
+        }
+        s = &(*stats)[n];
+        memset(s, 0, sizeof(*s));
+
+        /* undo the quoting done by write_results */
+        f = s->filename;
+        for (; *p && j < MAXLINE - 1; p++) {
+            if (*p == '"' && !(csv && p[1] == '"'))
+                break;
+            if ((*p == '"' && csv) || (*p == '\\' && !csv))
+                p++;
+            f[j++] = *p;
+        }
+        f[j] = '\0';
+        rest = p + 1;
+
+        if (csv) {
+            double kops;
+            if (sscanf(rest, ",%d,%d,%lf,%lf,%lf,%lf,%lf", &s->valid,
+                       &s->weight, &s->util, &s->ops, &s->secs, &kops,
+                       &s->noise) != 7)
+                app_error("Bad line in baseline %s: %s", filename, line);
+        } else {
+            s->valid = (int)json_field(rest, "valid");
+            s->weight = (int)json_field(rest, "weight");
+            s->util = json_field(rest, "util");
+            s->ops = json_field(rest, "ops");
+            s->secs = json_field(rest, "secs");
+            s->noise = json_field(rest, "noise");
+        }
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/*
+ * compare_baseline - Compare this run with the baseline in filename and
+ *     print a table of the differences. Returns the number of traces
+ *     that regressed.
+ */
+static int compare_baseline(const char *filename, int n, const stats_t *stats)
+{
+    stats_t *base;
+    int nbase, i, j, regressions = 0;
+
+    nbase = read_baseline(filename, &base);
+
+    printf("\nComparison with baseline %s:\n", filename);
+    printf("  %6s %6s %9s %9s %7s %6s  %s\n",
+           "util0", "util", "Kops0", "Kops", "change", "tol", "trace");
+    for (i = 0; i < n; i++) {
+        const stats_t *b = NULL;
+        const char *flag = "";
+        double k0, k1, change = 0, tol;
+
+        for (j = 0; j < nbase; j++)
+            if (strcmp(base[j].filename, stats[i].filename) == 0)
+                b = &base[j];
+        if (b == NULL) {
+            printf("  %6s %6s %9s %9s %7s %6s  %s (not in baseline)\n",
+                   "-", "-", "-", "-", "-", "-", stats[i].filename);
+            continue;
+        }
+
+        k0 = kops(b);
+        k1 = kops(&stats[i]);
+        tol = 2 * (b->noise + stats[i].noise);
+        if (tol < REGRESS_MIN_TOL)
+            tol = REGRESS_MIN_TOL;
+        if (k0 > 0)
+            change = (k1 - k0) / k0;
+
+        if (b->valid && !stats[i].valid)
+            flag = "  INVALID";
+        else if (b->util - stats[i].util > REGRESS_UTIL_TOL)
+            flag = "  UTIL";
+        else if (k0 > 0 && change < -tol)
+            flag = "  SLOWER";
+        if (*flag)
+            regressions++;
+
+        printf("  %5.1f%% %5.1f%% %9.0f %9.0f %+6.1f%% %5.1f%%  %s%s\n",
+               b->util * 100.0, stats[i].util * 100.0, k0, k1,
+               change * 100.0, tol * 100.0, stats[i].filename, flag);
+    }
+    if (regressions)
+        printf("%d trace(s) regressed against the baseline\n", regressions);
+    else
+        printf("No regressions against the baseline\n");
+
+    free(base);
+    return regressions;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1429,11 +3730,13 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hlnLPVdDSwxz] [-a <lib>] [-I <secs>] [-j <n>] [-k <n>] [-T <n>] [-H <k,..>] [-f <file>] [-o <file>] [-b <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-p         Calculate Checkpoint Score.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
+    fprintf(stderr, "\t-x         Verify block data by checksum (cheaper with -D).\n");
+    fprintf(stderr, "\t-a <lib>   Also evaluate the allocator plug-in <lib>; may be repeated.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
@@ -1441,5 +3744,25 @@ static void usage(void)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces in parallel, one per core.\n");
+    fprintf(stderr, "\t-I <secs>  Time by the median and its 95%% confidence interval, sampling\n");
+    fprintf(stderr, "\t           until it is within 2%% or <secs> per trace run out.\n");
+    fprintf(stderr, "\t-w         Time from a flushed last-level cache; also print warm Kops.\n");
+    fprintf(stderr, "\t-z         As -w, and drop the heap's pages before each cold run.\n");
+    fprintf(stderr, "\t-k <n>     Also print Kops of the warm-up, ops before op n (or n%% of the\n");
+    fprintf(stderr, "\t           trace), and of the steady state after it, replayed each time\n");
+    fprintf(stderr, "\t           from a forked snapshot of the heap at op n.\n");
+    fprintf(stderr, "\t-n         Also time each trace on a null allocator; print the driver's\n");
+    fprintf(stderr, "\t           ns per op and Kops net of them.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles for each trace.\n");
+    fprintf(stderr, "\t-P         Print hardware performance counters per op for each trace.\n");
+    fprintf(stderr, "\t-S         Stream traces in one pass, for traces larger than RAM.\n");
+    fprintf(stderr, "\t           Secs include the debug checks; use -d0 for timing.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-T <n>     Sample live, heap and free bytes every n ops into\n");
+    fprintf(stderr, "\t           <trace>.timeline.csv (not with -S). With -a, the files are\n");
+    fprintf(stderr, "\t           <trace>.<allocator>.timeline.csv, and so for -H.\n");
+    fprintf(stderr, "\t-H <k,..>  Write the block layout after k ops to <trace>.heap.bin.\n");
+    fprintf(stderr, "\t-o <file>  Write per-trace results to <file> (CSV if *.csv, else JSON).\n");
+    fprintf(stderr, "\t-b <file>  Compare with a baseline from -o; exit 1 on regressions.\n");
 }
@@ -0,0 +1,127 @@
+/*
+ * memlib-sys.c - memlib for allocators running as a real process's
+ *     malloc (libmm.so). Same interface as memlib.c, but the heap is
+ *     address space reserved once, anywhere the kernel likes, and
+ *     committed a chunk at a time as mem_sbrk grows into it. Nothing
+ *     here calls malloc or stdio, since we may be the malloc.
+ */
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "memlib.h"
+
+/* mm.c keeps free-list links as 32-bit offsets from the heap base */
+#define SYS_RESERVE ((size_t)1 << 32)
+
+/* Commit the reservation this many bytes at a time */
+#define SYS_COMMIT  ((size_t)1 << 20)
+
+/* private variables */
+static char *heap;
+static char *mem_brk;
+static char *mem_committed;	/* end of the read/write part */
+static char *mem_max_addr;
+
+/* 
+ * mem_init - reserve the heap's address space, inaccessible for now.
+ *		On failure the heap is empty and every mem_sbrk fails.
+ */
+void mem_init(void){
+	void *p = mmap(NULL, SYS_RESERVE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	heap = p == MAP_FAILED ? NULL : p;
+	mem_brk = mem_committed = heap;
+	mem_max_addr = heap ? heap + SYS_RESERVE : NULL;
+}
+
+/* 
+ * mem_deinit - give the reservation back
+ */
+void mem_deinit(void){
+	if (heap)
+		munmap(heap, SYS_RESERVE);
+	heap = mem_brk = mem_committed = mem_max_addr = NULL;
+}
+
+/*
+ * mem_reset_brk - make an empty heap, keeping what is committed
+ */
+void mem_reset_brk(){
+	mem_brk = heap;
+}
+
+/* 
+ * mem_sbrk - extend the heap by incr bytes, committing more of the
+ *		reservation first if need be. The heap cannot be shrunk.
+ */
+void *mem_sbrk(int incr) {
+	char *old_brk = mem_brk;
+
+	if (heap == NULL || incr < 0 || (size_t)incr > (size_t)(mem_max_addr - mem_brk)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+
+	if (mem_brk + incr > mem_committed) {
+		size_t need = (size_t)(mem_brk + incr - mem_committed);
+		need = (need + SYS_COMMIT - 1) & ~(SYS_COMMIT - 1);
+		if (need > (size_t)(mem_max_addr - mem_committed))
+			need = mem_max_addr - mem_committed;
+		if (mprotect(mem_committed, need, PROT_READ | PROT_WRITE) != 0) {
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+		mem_committed += need;
+	}
+
+	mem_brk += incr;
+	return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(){
+	return (void *)heap;
+}
+
+/* 
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(){
+	return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() {
+	return (size_t)(mem_brk - heap);
+}
+
+/*
+ * mem_discard - give the committed pages back to the kernel; they
+ *	read as zero after
+ */
+void mem_discard(void) {
+	madvise(heap, (size_t)(mem_committed - heap), MADV_DONTNEED);
+}
+
+/*
+ * mem_remap - always refuses, so mm.c copies. Moving pages would split
+ *	the reservation into a mapping per move, and a real process has
+ *	no mem_reset_brk at which to join them up again.
+ */
+int mem_remap(void *dst, void *src, size_t len) {
+	return -1;
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(){
+	return (size_t)getpagesize();
+}
@@ -3,6 +3,7 @@
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -21,6 +22,19 @@ static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
 
+/* mem_remap swaps runs of pages between two places in the heap, by way
+   of a scratch reservation as large as the heap. Each run it moves
+   becomes a mapping of its own, and mremap cannot move a range that
+   spans two mappings, so the places where the heap may be split are
+   kept here, sorted, and runs are moved a piece at a time. A trace
+   splits the heap at the same places on every run, so the cuts are
+   only cleared, by mapping the heap afresh, once they get too many. */
+#define MAX_CUTS 16384
+#define MAX_PIECES 64
+static char *scratch;
+static char *cuts[MAX_CUTS];
+static int num_cuts;
+
 /* 
  * mem_init - initialize the memory system model
  */
@@ -34,6 +48,11 @@ void mem_init(void){
 			0);						/* offset (dunno) */
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	scratch = mmap(NULL, MAX_HEAP, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (scratch == MAP_FAILED)
+		scratch = NULL;			/* mem_remap then always refuses */
+	num_cuts = 0;
 }
 
 /* 
@@ -41,13 +60,24 @@ void mem_init(void){
  */
 void mem_deinit(void){
 	munmap(heap, MAX_HEAP);
+	if (scratch)
+		munmap(scratch, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *	If mem_remap has split the heap up a lot, map it afresh as one piece.
  */
 void mem_reset_brk(){
 	mem_brk = heap;
+	if (num_cuts > MAX_CUTS / 2) {
+		if (mmap(heap, MAX_HEAP, PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			fprintf(stderr, "ERROR: mem_reset_brk could not remap the heap\n");
+			exit(1);
+		}
+		num_cuts = 0;
+	}
 }
 
 /* 
@@ -91,6 +121,112 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_discard - give the heap's pages back to the kernel, so that the
+ *	next run faults them in afresh. The contents read as zero after.
+ */
+void mem_discard(void) {
+	madvise(heap, MAX_HEAP, MADV_DONTNEED);
+}
+
+/* first_cut - index of the first cut above p */
+static int first_cut(const char *p) {
+	int lo = 0, hi = num_cuts;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cuts[mid] <= p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void add_cut(char *p) {
+	int i = first_cut(p);
+
+	if ((i > 0 && cuts[i - 1] == p) || num_cuts == MAX_CUTS)
+		return;
+	memmove(&cuts[i + 1], &cuts[i], (num_cuts - i) * sizeof(cuts[0]));
+	cuts[i] = p;
+	num_cuts++;
+}
+
+/* add_offsets - the offsets from p of the cuts inside [p, p+len) */
+static int add_offsets(size_t *offs, int n, char *p, size_t len) {
+	int i;
+
+	for (i = first_cut(p); i < num_cuts && cuts[i] < p + len; i++) {
+		if (n == MAX_PIECES)
+			return -1;
+		offs[n++] = cuts[i] - p;
+	}
+	return n;
+}
+
+static int cmp_offset(const void *a, const void *b) {
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* move - mremap the run at from to to, which must not fail half way */
+static void move(char *from, char *to, size_t len) {
+	if (mremap(from, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, to) == MAP_FAILED) {
+		fprintf(stderr, "ERROR: mem_remap left a hole in the heap\n");
+		exit(1);
+	}
+}
+
+/*
+ * mem_remap - give dst the pages of src, and src the pages of dst, by
+ *	moving page table entries rather than bytes. Both runs are page
+ *	aligned, len bytes long, inside the heap and apart. Returns 0, or
+ *	-1 with nothing done if the heap has been split too often, and then
+ *	the caller copies.
+ */
+int mem_remap(void *dst, void *src, size_t len) {
+	char *s = src, *d = dst;
+	size_t offs[MAX_PIECES + 1], a, b;
+	int i, n;
+
+	if (scratch == NULL)
+		return -1;
+	/* split both runs wherever either of them may be */
+	if ((n = add_offsets(offs, 0, s, len)) < 0 ||
+	    (n = add_offsets(offs, n, d, len)) < 0 ||
+	    num_cuts + 2 * n + 4 > MAX_CUTS)
+		return -1;
+	qsort(offs, n, sizeof(offs[0]), cmp_offset);
+	offs[n] = len;
+
+	for (a = 0, i = 0; i <= n; a = b, i++) {
+		if ((b = offs[i]) == a)
+			continue;
+		/* the first move only unmaps scratch if it fails, so copy */
+		if (mremap(d + a, b - a, b - a, MREMAP_MAYMOVE | MREMAP_FIXED,
+				scratch) == MAP_FAILED) {
+			memcpy(d + a, s + a, len - a);
+			break;
+		}
+		move(s + a, d + a, b - a);
+		move(scratch, s + a, b - a);
+	}
+	/* moving out of scratch unmapped it; keep it ours */
+	mmap(scratch, len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+	for (i = 0; i < n; i++) {
+		add_cut(s + offs[i]);
+		add_cut(d + offs[i]);
+	}
+	add_cut(s);
+	add_cut(s + len);
+	add_cut(d);
+	add_cut(d + len);
+	return 0;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
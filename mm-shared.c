@@ -0,0 +1,319 @@
+/*
+ * mm-shared.c - Export mm.c as the process's malloc, so that real
+ *     programs can run on it:
+ *
+ *     unix> LD_PRELOAD=./libmm.so ./app
+ *
+ * mm.c is compiled with -DDRIVER, so it defines mm_malloc and friends,
+ * and runs on memlib-sys.c instead of the simulated heap. This file
+ * supplies the C library entry points around it:
+ *
+ *   - mm.c is single-threaded, so one mutex covers every call, and
+ *     fork handlers keep the child from inheriting it locked.
+ *   - mem_init and mm_init run on the first call, whenever that is.
+ *   - mm.c aligns to 8 bytes, but malloc has to align to 16, as glibc's
+ *     does for max_align_t. Each request gets HEAP_PAD more bytes from
+ *     mm.c, and the pointer returned is the first 16-byte boundary past
+ *     the 8 bytes that follow, where a word records how far in it is
+ *     and how many bytes were asked for.
+ *   - mm.c has 32-bit sizes and offsets. Requests for more alignment
+ *     than 16, or for BIG_BLOCK bytes or more, get their own mmap
+ *     instead. Those blocks lie outside the heap and carry a header
+ *     just below the payload, which is how free and realloc tell them
+ *     apart.
+ *   - malloc(0) returns a unique pointer, as glibc's does.
+ *
+ * Build this file with -fno-builtin: otherwise gcc turns the malloc and
+ * memset in calloc into a call to calloc, which is this calloc.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define BIG_BLOCK  ((size_t)1 << 30)
+#define MAP_MAGIC  0x6d6d6d6170ULL      /* "mmmap" */
+#define MIN_ALIGN  16                   /* what malloc guarantees */
+#define HEAP_PAD   16                   /* extra bytes asked of mm.c */
+
+/* Header of a block that has its own mapping */
+typedef struct {
+    size_t map_len;              /* length of the whole mapping */
+    uint32_t offset;             /* payload - mapping start */
+    uint32_t pad;
+    uint64_t magic;              /* MAP_MAGIC */
+    size_t size;                 /* payload bytes requested */
+} maphdr_t;
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mm_ready = 0;
+
+static void mm_lock_prepare(void)
+{
+    pthread_mutex_lock(&mm_lock);
+}
+
+static void mm_lock_release(void)
+{
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * ensure_init - Set up the heap on the first call. Called with the
+ *     lock held; returns 0 if the heap cannot be set up.
+ */
+static int ensure_init(void)
+{
+    if (mm_ready)
+        return 1;
+    mem_init();
+    if (mm_init() < 0)
+        return 0;
+    pthread_atfork(mm_lock_prepare, mm_lock_release, mm_lock_release);
+    mm_ready = 1;
+    return 1;
+}
+
+/* Is p a payload in mm.c's heap, rather than in its own mapping? */
+static int in_mm_heap(const void *p)
+{
+    return mm_ready && p >= mem_heap_lo() && p <= mem_heap_hi();
+}
+
+/*
+ * heap_payload - The 16-byte aligned payload inside block p from
+ *     mm_malloc, 8 or 16 bytes in, with its word below it filled in
+ */
+static void *heap_payload(void *p, size_t size)
+{
+    char *q = (char *)(((uintptr_t)p + HEAP_PAD) & ~(uintptr_t)(MIN_ALIGN - 1));
+
+    ((uint64_t *)q)[-1] = (uint64_t)size << 8 | (uint64_t)(q - (char *)p);
+    return q;
+}
+
+/* How far payload q is into its mm.c block, and the bytes asked for */
+static size_t heap_offset(const void *q)
+{
+    return ((const uint64_t *)q)[-1] & 0xff;
+}
+
+static size_t heap_size(const void *q)
+{
+    return ((const uint64_t *)q)[-1] >> 8;
+}
+
+static maphdr_t *map_header(void *p)
+{
+    return (maphdr_t *)((char *)p - sizeof(maphdr_t));
+}
+
+/*
+ * map_alloc - Give a block its own mapping, with the payload aligned
+ *     to align (a power of two) and the header just below it.
+ */
+static void *map_alloc(size_t size, size_t align)
+{
+    size_t page = (size_t)getpagesize();
+    size_t offset, len;
+    char *base;
+    maphdr_t *h;
+
+    if (align < sizeof(maphdr_t))
+        align = sizeof(maphdr_t);
+    offset = (sizeof(maphdr_t) + align - 1) & ~(align - 1);
+    if (size > SIZE_MAX - offset - 2 * align - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* alignments beyond a page need slack to slide the payload into */
+    len = (offset + size + (align > page ? align : 0) + page - 1) & ~(page - 1);
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    offset = ((((uintptr_t)base + sizeof(maphdr_t) + align - 1) & ~(align - 1))
+              - (uintptr_t)base);
+
+    h = (maphdr_t *)(base + offset - sizeof(maphdr_t));
+    h->map_len = len;
+    h->offset = (uint32_t)offset;
+    h->magic = MAP_MAGIC;
+    h->size = size;
+    return base + offset;
+}
+
+static void map_free(void *p)
+{
+    maphdr_t *h = map_header(p);
+
+    if (h->magic != MAP_MAGIC)
+        return;      /* not ours; leaking it beats corrupting the heap */
+    h->magic = 0;
+    munmap((char *)p - h->offset, h->map_len);
+}
+
+/*
+ * aligned - Common path of memalign and friends
+ */
+static void *aligned(size_t align, size_t size)
+{
+    if (align <= MIN_ALIGN)
+        return malloc(size);
+    if (align & (align - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return map_alloc(size, align);
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (size >= BIG_BLOCK - HEAP_PAD)
+        return map_alloc(size, MIN_ALIGN);
+
+    pthread_mutex_lock(&mm_lock);
+    p = ensure_init() ? mm_malloc(size + HEAP_PAD) : NULL;
+    pthread_mutex_unlock(&mm_lock);
+    if (p == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return heap_payload(p, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    pthread_mutex_lock(&mm_lock);
+    if (in_mm_heap(ptr)) {
+        mm_free((char *)ptr - heap_offset(ptr));
+        pthread_mutex_unlock(&mm_lock);
+        return;
+    }
+    pthread_mutex_unlock(&mm_lock);
+    map_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    char *p, *q;
+    size_t old, off;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&mm_lock);
+    if (in_mm_heap(ptr) && size < BIG_BLOCK - HEAP_PAD) {
+        old = heap_size(ptr);
+        off = heap_offset(ptr);
+        p = mm_realloc((char *)ptr - off, size + HEAP_PAD);
+        pthread_mutex_unlock(&mm_lock);
+        if (p == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        /* the new block may sit 8 bytes off from the old one's alignment */
+        q = (char *)(((uintptr_t)p + HEAP_PAD) & ~(uintptr_t)(MIN_ALIGN - 1));
+        if ((size_t)(q - p) != off)
+            memmove(q, p + off, old < size ? old : size);
+        return heap_payload(p, size);
+    }
+    pthread_mutex_unlock(&mm_lock);
+
+    /* Moving into or out of a mapping of its own */
+    if ((p = malloc(size)) == NULL)
+        return NULL;
+    old = in_mm_heap(ptr) ? heap_size(ptr) : map_header(ptr)->size;
+    memcpy(p, ptr, old < size ? old : size);
+    free(ptr);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((p = malloc(nmemb * size)) != NULL)
+        memset(p, 0, nmemb * size);
+    return p;
+}
+
+/* glibc's version would hand our blocks to its own realloc */
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    return aligned(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return aligned(align, size);
+}
+
+int posix_memalign(void **pp, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)))
+        return EINVAL;
+    if ((p = aligned(align, size)) == NULL)
+        return ENOMEM;
+    *pp = p;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return map_alloc(size, (size_t)getpagesize());
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = (size_t)getpagesize();
+    return map_alloc((size + page - 1) & ~(page - 1), page);
+}
+
+/* glibc's version would look for its own chunk header below ptr */
+size_t malloc_usable_size(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+        return 0;
+    pthread_mutex_lock(&mm_lock);
+    if (in_mm_heap(ptr)) {
+        size = heap_size(ptr);
+        pthread_mutex_unlock(&mm_lock);
+        return size;
+    }
+    pthread_mutex_unlock(&mm_lock);
+    return map_header(ptr)->magic == MAP_MAGIC ? map_header(ptr)->size : 0;
+}
@@ -182,10 +182,79 @@ void *realloc(void *ptr, size_t size)
  * mm_checkheap - Check the heap for correctness. Helpful hint: You
  *                can call this function using mm_checkheap(__LINE__);
  *                to identify the line number of the call site.
+ *                Walks every block, prints only what is wrong, and
+ *                returns the number of errors.
  */
-void mm_checkheap(int lineno)  
+int mm_checkheap(int lineno)  
 { 
-    lineno = lineno; /* keep gcc happy */
+    char *bp;
+    int errors = 0;
+
+    if (heap_listp == 0)
+        return 0;
+    if (GET(HDRP(heap_listp)) != PACK(DSIZE, 1) ||
+        GET(FTRP(heap_listp)) != PACK(DSIZE, 1)) {
+        printf("mm_checkheap(%d): bad prologue\n", lineno);
+        errors++;
+    }
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if ((size_t)bp % DSIZE || bp < (char *)mem_heap_lo() ||
+            bp > (char *)mem_heap_hi()) {
+            printf("mm_checkheap(%d): bad block pointer %p\n", lineno, bp);
+            return errors + 1;
+        }
+        if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+            printf("mm_checkheap(%d): header and footer of %p differ\n",
+                   lineno, bp);
+            errors++;
+        }
+        if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+            printf("mm_checkheap(%d): free blocks %p and %p not coalesced\n",
+                   lineno, bp, NEXT_BLKP(bp));
+            errors++;
+        }
+    }
+    if (!GET_ALLOC(HDRP(bp)) || bp - 1 != (char *)mem_heap_hi()) {
+        printf("mm_checkheap(%d): bad epilogue\n", lineno);
+        errors++;
+    }
+    return errors;
+}
+
+/*
+ * mm_heapwalk - Report every block between the prologue and epilogue
+ */
+void mm_heapwalk(mm_walk_fn fn, void *arg)
+{
+    char *lo = mem_heap_lo();
+    char *bp;
+
+    if (heap_listp == 0)
+        return;
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+        fn(arg, bp - lo, GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)));
+}
+
+/*
+ * mm_heapstats - Walk the implicit list, totalling the free blocks
+ */
+void mm_heapstats(size_t *free_bytes, size_t *largest_free)
+{
+    char *bp;
+    size_t size;
+
+    *free_bytes = 0;
+    *largest_free = 0;
+    if (heap_listp == 0)
+        return;
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            size = GET_SIZE(HDRP(bp));
+            *free_bytes += size;
+            if (size > *largest_free)
+                *largest_free = size;
+        }
+    }
 }
 
 /* 
@@ -5,13 +5,19 @@
  * comment that gives a high level description of your solution.
  */
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_classes.h"
+#include "mm_fast.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -40,6 +46,13 @@ static char *base_ptr = 0; // the very first address of the heap
 #define DSIZE 8
 #define ALIGNMENT 8
 #define CHUNKSIZE (1<<12)
+/* 这么大的块在realloc变大时先试试原地长大(grow_in_place)，
+ * 到了REMAP_MIN再试试搬页(grow_by_remap)，都不用复制整个payload */
+#define GROW_MIN (1<<17)
+#define REMAP_MIN (1<<20)
+/* grow_by_remap按这么大的整块搬页：每搬一块要几次系统调用，还会把堆的映射
+ * 切开，块太小的话还不如memcpy。必须是页大小的倍数 */
+#define REMAP_GRAIN (1<<18)
 
 /* 简单的求最大值的 */
 #define MAX(x, y) ((x) > (y)? (x) : (y))
@@ -82,6 +95,33 @@ static char *heap_listp = 0;  // 指向Prologue的指针
 the heap. */
 /* 因此我们在mm_init函数里面开辟不同的大小类的头指针 */
 static char *segragated_listp; // 指向分离链表的指针
+/* 大小类的个数和边界在mm_classes.h里，可以用mmclasses按trace生成。
+ * 链表头放在堆的最前面，凑成奇数个字，这样第一个块的payload还是8字节对齐 */
+#define LIST_WORDS (MM_NCLASSES | 1)
+
+/* mm_checkheap用的：上次检查以来被改过的块（相对base_ptr的偏移）
+ * 记满了就放弃记录，下次检查做一次全量扫描 */
+#define DIRTY_MAX 64
+#define FULL_CHECK_EVERY 1024 // 每检查这么多次做一次全量扫描
+static unsigned int dirty[DIRTY_MAX];
+static int dirty_count;       // > DIRTY_MAX表示记满了
+static unsigned int check_calls;
+static int check_line;        // 当前检查的调用位置，用于报错
+static int check_errors;      // 当前检查发现的错误数
+
+/* 每个大小类在堆外还有一份紧凑的索引：块大小和偏移两个数组，顺序和链表一样
+ * (从大到小，一样大的后插入的在前)。找块、找插入位置、删除时找位置都只在
+ * 这两个连续的数组上比较，不用顺着succ在堆里一个块一个块地跳。
+ * 某个大小类的空闲块超过INDEX_CAP个，它的索引就作废，退回到走链表，
+ * 直到下次mm_init。用-DMM_NO_INDEX编译就一直走链表，make bench-index拿它比较 */
+#define INDEX_CAP 4096
+static unsigned int index_size[MM_NCLASSES][INDEX_CAP];
+static unsigned int index_off[MM_NCLASSES][INDEX_CAP];
+static int index_len[MM_NCLASSES];      // > INDEX_CAP表示作废了
+
+/* mm_fast.h的每个大小类的缓存，里面的块在这边看来都还是分配出去的 */
+void *mm_fast_list[MM_FAST_CLASSES];
+unsigned int mm_fast_count[MM_FAST_CLASSES];
 
 static int in_heap(const void *p);
 static int aligned(const void *p);
@@ -92,6 +132,12 @@ static void segragated_list_delete(void *ptr);
 static void *find_fit(size_t size);
 static void place(void *ptr, size_t size);
 static void *segragated_list_search(size_t size);
+static void mark_dirty(void *ptr);
+static void unmark_dirty(void *ptr);
+static int index_above(const unsigned int *a, int n, unsigned int x);
+static int index_find(const unsigned int *a, int from, int n, unsigned int x);
+static void *grow_in_place(void *ptr, size_t size);
+static void *grow_by_remap(void *ptr, size_t size);
 static unsigned int GET_BIAS(void *ptr) {
     if (ptr == NULL) return 0;
     return (unsigned int)((char *)ptr - base_ptr);
@@ -109,25 +155,29 @@ int mm_init(void) {
     // 根据内存的模型，我们先要初始化一个堆，这个堆的大小是2*DSIZE
 
     // You must reinitialize all of your global pointers in this function.
-    if ((heap_listp = mem_sbrk(12*WSIZE)) == (void *)-1)
+    if ((heap_listp = mem_sbrk((LIST_WORDS + 3)*WSIZE)) == (void *)-1)
         return -1;
-    PUT(heap_listp, 0); // 大小类为0~31
-    PUT(heap_listp + (1*WSIZE), 0); // 大小类为32~63
-    PUT(heap_listp + (2*WSIZE), 0); // 大小类为64~127
-    PUT(heap_listp + (3*WSIZE), 0); // 大小类为128~255
-    PUT(heap_listp + (4*WSIZE), 0); // 大小类为256~511
-    PUT(heap_listp + (5*WSIZE), 0); // 大小类为512~1023
-    PUT(heap_listp + (6*WSIZE), 0); // 大小类为1024~2047
-    PUT(heap_listp + (7*WSIZE), 0); // 大小类为2048~4095
-    PUT(heap_listp + (8*WSIZE), 0); // 大小类为>=4096
-    PUT(heap_listp + (9*WSIZE), PACK(DSIZE, 1)); // Prologue header
-    PUT(heap_listp + (10*WSIZE), PACK(DSIZE, 1)); // Prologue footer
-    PUT(heap_listp + (11*WSIZE), PACK(0, 1)); // Epilogue header
+    for (int i = 0; i < LIST_WORDS; i++)
+        PUT(heap_listp + (i*WSIZE), 0); // 大小类i的链表头，从mm_class_lo[i]开始
+    PUT(heap_listp + (LIST_WORDS*WSIZE), PACK(DSIZE, 1)); // Prologue header
+    PUT(heap_listp + ((LIST_WORDS + 1)*WSIZE), PACK(DSIZE, 1)); // Prologue footer
+    PUT(heap_listp + ((LIST_WORDS + 2)*WSIZE), PACK(0, 1)); // Epilogue header
 
     // printf("heap_listp = %p\n", heap_listp);
     base_ptr = heap_listp - WSIZE;
     segragated_listp = heap_listp;
-    heap_listp += (10*WSIZE);
+    heap_listp += ((LIST_WORDS + 1)*WSIZE);
+    dirty_count = DIRTY_MAX + 1; // 新的堆，第一次检查做全量扫描
+    check_calls = 0;
+    memset(mm_fast_list, 0, sizeof(mm_fast_list)); // 旧的堆没了，缓存也要清空
+    memset(mm_fast_count, 0, sizeof(mm_fast_count));
+    for (int i = 0; i < MM_NCLASSES; i++) {
+#ifdef MM_NO_INDEX
+        index_len[i] = INDEX_CAP + 1;
+#else
+        index_len[i] = 0;
+#endif
+    }
     // printf("heap_listp = %p\n", heap_listp);
     // 然后我们把这个堆扩展到最大
     if (extend_heap(CHUNKSIZE) == NULL)
@@ -202,6 +252,19 @@ void *realloc(void *oldptr, size_t size) {
         return malloc(size);
     }
 
+#ifndef MM_COPY_REALLOC
+    /* 大块变大：先试试原地长大，再试试把页搬过去，都不用复制。
+     * 用-DMM_COPY_REALLOC编译就总是复制，make bench-realloc拿它来比较 */
+    oldsize = GET_SIZE(HDRP(oldptr));
+    if (oldsize >= GROW_MIN && ALIGN(size + DSIZE) > oldsize) {
+        if ((newptr = grow_in_place(oldptr, ALIGN(size + DSIZE))) != NULL)
+            return newptr;
+        if (oldsize >= REMAP_MIN &&
+            (newptr = grow_by_remap(oldptr, ALIGN(size + DSIZE))) != NULL)
+            return newptr;
+    }
+#endif
+
     newptr = malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -250,96 +313,180 @@ static int aligned(const void *p) {
     return (size_t)ALIGN(p) == (size_t)p;
 }
 
-/*
- * mm_checkheap- Check the heap for correctness. Helpful hint: You
- *                can call this function using mm_checkheap(__LINE__);
- *                to identify the line number of the call site.
- * 
- */
-void mm_checkheap(int lineno) {
-    int free_count = 0;
-    printf("Check heap at line %d\n", lineno);
-    /* 输出Heap的指针 */
-    printf("Heap (%p):\n", heap_listp);
-    /* 检查Prologue和Epilogue */
-    /* 如果Prologue的块大小不是DSIZE的话，说明是有问题的，或者Prologue直接是未分配的 */
+/* 条件不成立就报告一个错误，只有出错的时候才输出 */
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("mm_checkheap(%d): ", check_line);           \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            check_errors++;                                     \
+        }                                                       \
+    } while (0)
+
+/* 每个大小类的块大小范围是[bucket_lo(i), bucket_lo(i+1))，最后一个没有上界 */
+static size_t bucket_lo(int i) {
+    return mm_class_lo[i];
+}
+
+/* 检查一个空闲块的pred和succ是否和链表里的邻居一致 */
+static void check_links(void *ptr) {
+    void *pred = GET_PTR(PRED(ptr));
+    void *succ = GET_PTR(SUCC(ptr));
+    char *heads = segragated_listp;
+
+    CHECK(pred != NULL, "free block %p is in no list", ptr);
+    if (pred == NULL) return;
+    if ((char *)pred >= heads && (char *)pred < heads + MM_NCLASSES * WSIZE) {
+        /* 是链表的第一个块，pred就是链表头 */
+        CHECK(GET(pred) == GET_BIAS(ptr), "list head %p does not point to %p", pred, ptr);
+        CHECK(pred == segragated_list_search(GET_SIZE(HDRP(ptr))),
+              "free block %p of size %u is in the wrong list", ptr, GET_SIZE(HDRP(ptr)));
+    } else {
+        CHECK(in_heap(pred) && SUCC(pred) == GET_BIAS(ptr), "pred of %p does not point back", ptr);
+    }
+    if (succ != NULL)
+        CHECK(in_heap(succ) && PRED(succ) == GET_BIAS(ptr), "succ of %p does not point back", ptr);
+}
+
+/* 检查一个块自身和它与前后块的关系 */
+static void check_block(void *ptr) {
+    CHECK(in_heap(ptr), "%p is not in heap", ptr);
+    CHECK(aligned(ptr), "%p is not aligned", ptr);
+    if (!in_heap(ptr) || !aligned(ptr)) return;
+    CHECK(GET(HDRP(ptr)) == GET(FTRP(ptr)), "header and footer of %p do not match", ptr);
+    CHECK(GET_SIZE(HDRP(ptr)) >= 2*DSIZE, "%p has size %u", ptr, GET_SIZE(HDRP(ptr)));
+    if (!GET_ALLOC(HDRP(ptr))) {
+        CHECK(GET_ALLOC(HDRP(NEXT_BLKP(ptr))) && GET_ALLOC((char *)ptr - DSIZE),
+              "free block %p has a free neighbour", ptr);
+        check_links(ptr);
+    }
+}
+
+/* 全量扫描：所有块按地址走一遍，再把每个链表走一遍 */
+static void check_full(void) {
+    int free_count = 0, free_count_in_list = 0;
+    int i;
     void *prologue = heap_listp;
-    if ((GET_SIZE(HDRP(prologue)) != DSIZE) || !GET_ALLOC(HDRP(prologue)) 
-    || (GET(HDRP(prologue)) != GET(FTRP(prologue))) || !aligned(prologue))
-        printf("Bad prologue header\n");
-    printf("Prologue header: [%d:%d] footer: [%d:%d]\n", GET_SIZE(HDRP(prologue)), GET_ALLOC(HDRP(prologue)), GET_SIZE(FTRP(prologue)), GET_ALLOC(FTRP(prologue)));
-    /* 每个块都要检查 是否双字对齐的以及Header和Footer中存储的信息是否是一样的*/
-    void *ptr = NEXT_BLKP(prologue);
-    for (; GET_SIZE(HDRP(ptr)) > 0; ptr = NEXT_BLKP(ptr)) {
-        if (!in_heap(ptr)) printf("Error: %p is not in heap\n", ptr);
-        if (!aligned(ptr)) printf("Error: %p is not aligned\n", ptr);
-        if (GET(HDRP(ptr)) != GET(FTRP(ptr))) printf("Error: Header and Footer do not match\n");
-        // 检查是否有连续的空闲块
-        if (!GET_ALLOC(HDRP(ptr)) && !GET_ALLOC(HDRP(NEXT_BLKP(ptr))))
-            printf("Error: Continuous free blocks\n");
+    void *ptr;
+
+    /* 检查Prologue和Epilogue */
+    CHECK(GET_SIZE(HDRP(prologue)) == DSIZE && GET_ALLOC(HDRP(prologue))
+          && GET(HDRP(prologue)) == GET(FTRP(prologue)) && aligned(prologue),
+          "bad prologue header");
+    /* 每个块都要检查 */
+    for (ptr = NEXT_BLKP(prologue); GET_SIZE(HDRP(ptr)) > 0; ptr = NEXT_BLKP(ptr)) {
+        check_block(ptr);
+        if (!in_heap(ptr)) return; // 块链已经断了，不要再往下走
         if (!GET_ALLOC(HDRP(ptr))) free_count++;
-        printf("%p: header: [%d:%d] footer: [%d:%d]\n", ptr, GET_SIZE(HDRP(ptr)), GET_ALLOC(HDRP(ptr)), GET_SIZE(FTRP(ptr)), GET_ALLOC(FTRP(ptr)));
     }
-    /* 如果Epilogue的块大小不是0的话，说明是有问题的，或者Epilogue直接是未分配的 */
-    if ((GET_SIZE(HDRP(ptr)) != 0) || !(GET_ALLOC(HDRP(ptr))) || !aligned(ptr))
-        printf("Bad epilogue header\n");
-    printf("Epilogue header: [%d:%d]\n", GET_SIZE(HDRP(ptr)), GET_ALLOC(HDRP(ptr)));
+    CHECK(GET_ALLOC(HDRP(ptr)) && aligned(ptr) && (char *)ptr - 1 == (char *)mem_heap_hi(),
+          "bad epilogue header");
+
+    /* 检查分离空闲链表，每个块都要在范围内、空闲，而且链表不能有环 */
+    /* 没作废的索引要和链表一项一项对得上 */
+    for (i = 0; i < MM_NCLASSES; i++) {
+        void *cur = GET_PTR(GET(segragated_listp + i * WSIZE));
+        int k = 0;
+        for (; cur != NULL; cur = GET_PTR(SUCC(cur)), k++) {
+            size_t size;
+            CHECK(in_heap(cur) && aligned(cur), "list %d has bad pointer %p", i, cur);
+            if (!in_heap(cur) || !aligned(cur)) break;
+            size = GET_SIZE(HDRP(cur));
+            CHECK(size >= bucket_lo(i) && (i == MM_NCLASSES - 1 || size < bucket_lo(i + 1)),
+                  "%p with size %zu is in list %d", cur, size, i);
+            CHECK(!GET_ALLOC(HDRP(cur)), "%p is allocated but in list %d", cur, i);
+            if (index_len[i] <= INDEX_CAP)
+                CHECK(k < index_len[i] && index_off[i][k] == GET_BIAS(cur)
+                      && index_size[i][k] == size,
+                      "index of list %d does not match the list at %d", i, k);
+            if (++free_count_in_list > free_count) break;
+        }
+        if (index_len[i] <= INDEX_CAP)
+            CHECK(k == index_len[i], "index of list %d has %d blocks, the list %d",
+                  i, index_len[i], k);
+    }
+
+    /* 检查空闲块的数量是否一致 */
+    CHECK(free_count == free_count_in_list,
+          "%d free blocks but %d in the lists", free_count, free_count_in_list);
+}
+
+/*
+ * mm_checkheap - 检查堆，返回发现的错误数，只有出错的时候才输出
+ * 平时只检查上次检查以来改过的块（以及它们和邻居、链表的关系），
+ * 每FULL_CHECK_EVERY次或者记录满了的时候做一次全量扫描。
+ * You can call this function using mm_checkheap(__LINE__);
+ * to identify the line number of the call site.
+ */
+int mm_checkheap(int lineno) {
+    int i;
+
+    check_line = lineno;
+    check_errors = 0;
+    if (heap_listp == 0) return 0;
+    if (dirty_count > DIRTY_MAX || ++check_calls % FULL_CHECK_EVERY == 0) {
+        check_full();
+    } else {
+        for (i = 0; i < dirty_count; i++)
+            check_block(GET_PTR(dirty[i]));
+    }
+    dirty_count = 0;
+    return check_errors;
+}
+
+/* mark_dirty - 记下一个被改过的块，留给下次检查 */
+static void mark_dirty(void *ptr) {
+    int i;
+    if (dirty_count > DIRTY_MAX) return;
+    for (i = 0; i < dirty_count; i++)
+        if (dirty[i] == GET_BIAS(ptr)) return;
+    if (dirty_count == DIRTY_MAX) {
+        dirty_count++; // 记满了
+        return;
+    }
+    dirty[dirty_count++] = GET_BIAS(ptr);
+}
 
+/* unmark_dirty - 一个块被合并掉了，它已经不是块的开头，不能再检查它 */
+static void unmark_dirty(void *ptr) {
+    int i;
+    if (dirty_count > DIRTY_MAX) return;
+    for (i = 0; i < dirty_count; i++)
+        if (dirty[i] == GET_BIAS(ptr)) {
+            dirty[i] = dirty[--dirty_count];
+            return;
+        }
+}
 
-    /* 检查分离空闲链表 */
-    /* 检查每个大小类的链表 */
-    int free_count_in_list = 0;
+/*
+ * mm_heapstats - 统计空闲块的总字节数和最大空闲块的大小
+ * 只需要遍历分离空闲链表，不用扫描整个堆
+ */
+void mm_heapstats(size_t *free_bytes, size_t *largest_free) {
+    size_t total = 0, largest = 0;
     int i;
-    for (i = 0; i < 9; i++) {
-        void *head = segragated_listp + i * WSIZE;
-        void *cur = GET_PTR(GET(head));
-        printf("segragated_listp + %d * WSIZE = %p\n", i, head);
-        printf("head = %p\n", head);
-        printf("head -> %p\n", GET_PTR(GET(head)));
+    for (i = 0; i < MM_NCLASSES; i++) {
+        void *cur = GET_PTR(GET(segragated_listp + i * WSIZE));
         while (cur != NULL) {
-            void *pred = GET_PTR(PRED(cur));
-            void *succ = GET_PTR(SUCC(cur));
-            printf("cur = %p\n", cur);
-            printf("cur's pred = %p\n", pred);
-            printf("cur's succ = %p\n", succ);
-            free_count_in_list++;
-
-            if (!in_heap(cur)) printf("Error: %p is not in heap\n", cur);
-            if (!aligned(cur)) printf("Error: %p is not aligned\n", cur);
-
-            /* All next/previous pointers are consistent 
-             * (if A’s next pointer points to B, B’s previous pointer
-             * should point to A). */
-            if (pred != NULL && ((pred == head && GET(head) != GET_BIAS(cur)) || (pred != head && SUCC(pred) != GET_BIAS(cur)))) {
-                printf("Error: Pred and Succ do not match\n");
-            }
-            if (succ != NULL && PRED(succ) != GET_BIAS(cur)) printf("Error: Pred and Succ do not match\n");
-
-            /* All free list pointers points between mem_heap_lo() and mem_heap_high(). */
-            if (cur != 0 && cur < mem_heap_lo()) printf("Error: %p is not in heap\n", cur);
-            if (cur != 0 && cur > mem_heap_hi()) printf("Error: %p is not in heap\n", cur);
-
-            /* All blocks in each list bucket fall within bucket size range (segregated list). */
             size_t size = GET_SIZE(HDRP(cur));
-            if (i == 0 && (size >= 32 || size <= 0)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 1 && (size >= 64 || size < 32)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 2 && (size >= 128 || size < 64)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 3 && (size >= 256 || size < 128)) printf("Error: %p with size %ld is not in range\n", cur,size);
-            if (i == 4 && (size >= 512 || size < 256)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 5 && (size >= 1024 || size < 512)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 6 && (size >= 2048 || size < 1024)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 7 && (size >= 4096 || size < 2048)) printf("Error: %p with size %ld is not in range\n", cur, size);
-            if (i == 8 && (size < 4096)) printf("Error: %p with size %ld is not in range\n", cur, size);
-             
-            if (GET_ALLOC(HDRP(cur))) printf("Error: %p is allocated\n", cur);
-            
-            if (GET(HDRP(cur)) != GET(FTRP(cur))) printf("Error: Header and Footer do not match\n");
+            total += size;
+            if (size > largest) largest = size;
             cur = GET_PTR(SUCC(cur));
         }
     }
+    *free_bytes = total;
+    *largest_free = largest;
+}
 
-    /* 检查空闲块的数量是否一致 */
-    if (free_count != free_count_in_list) printf("Error: free_count != free_count_in_list\n");
+/*
+ * mm_heapwalk - 按地址顺序把每个块的偏移、大小和分配状态交给fn
+ * 跳过Prologue，直到Epilogue为止
+ */
+void mm_heapwalk(mm_walk_fn fn, void *arg) {
+    char *lo = mem_heap_lo();
+    void *ptr;
+    for (ptr = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(ptr)) > 0; ptr = NEXT_BLKP(ptr))
+        fn(arg, (char *)ptr - lo, GET_SIZE(HDRP(ptr)), GET_ALLOC(HDRP(ptr)));
 }
 
 /* extend_heap - 利用sbrk来扩展当前的堆，同时处理新加入的空闲块 */
@@ -362,12 +509,136 @@ static void *extend_heap(size_t size) {
     PUT(FTRP(bp), PACK(size, 0)); // Free block footer
     /* 经过这样的扩展之后我们应该有一个新的Epilogue */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); // New epilogue header
+    /* 同一个trace会重复跑多次，新扩展出来的内存里可能有上一次留下的pred和succ */
+    PUT_PRED(bp, 0);
+    PUT_SUCC(bp, 0);
 
     /* 而且我们要使用什么样的合并策略呢？先使用立即合并 */
     /* 合并里面有插入链表的操作了 */
     return coalesce(bp);
 }
 
+/* grow_in_place - 后面是空闲块或者堆尾的话，让ptr原地长到size那么大。
+ * 不行的话返回NULL，什么都不改 */
+static void *grow_in_place(void *ptr, size_t size) {
+    char *next = NEXT_BLKP(ptr);
+    int next_free = !GET_ALLOC(HDRP(next));
+    size_t total = GET_SIZE(HDRP(ptr));
+
+    if (next_free)
+        total += GET_SIZE(HDRP(next));
+    if (total < size) {
+        /* 不够的话只能是后面就是Epilogue，把堆开大 */
+        if (GET_SIZE(HDRP((char *)ptr + total)) != 0)
+            return NULL;
+        if (mem_sbrk(size - total) == (void *)-1)
+            return NULL;
+    }
+    if (next_free) {
+        segragated_list_delete(next);
+        unmark_dirty(next);
+    }
+    if (total < size) {
+        total = size;
+        PUT(HDRP((char *)ptr + total), PACK(0, 1)); // New epilogue header
+    }
+
+    /* 多出来的部分和place里一样切下来 */
+    if (total - size >= 2*DSIZE) {
+        PUT(HDRP(ptr), PACK(size, 1));
+        PUT(FTRP(ptr), PACK(size, 1));
+        void *rest = NEXT_BLKP(ptr);
+        PUT(HDRP(rest), PACK(total - size, 0));
+        PUT(FTRP(rest), PACK(total - size, 0));
+        PUT_PRED(rest, 0);
+        PUT_SUCC(rest, 0);
+        coalesce(rest);
+    }
+    else {
+        PUT(HDRP(ptr), PACK(total, 1));
+        PUT(FTRP(ptr), PACK(total, 1));
+    }
+    mark_dirty(ptr);
+    return ptr;
+}
+
+/* grow_by_remap - 放一个size大的新块，payload和ptr对REMAP_GRAIN的偏移相同，
+ * 这样中间整块的部分可以用mem_remap搬过去，只动页表不复制字节。
+ * 新块先在空闲块里找，找不到就放在堆尾；前面凑偏移的空隙和后面剩下的
+ * 部分都当作空闲块。不行的话返回NULL，什么都不改 */
+static void *grow_by_remap(void *ptr, size_t size) {
+    size_t grain = REMAP_GRAIN;
+    char *brk = (char *)mem_heap_hi() + 1;
+    char *start;                  // 新的块(和空隙)从这里开始
+    size_t total, pad, rest, n, head, mid;
+    char *bp;
+
+    /* 空闲块要多留一个grain加一个最小块，才一定凑得出偏移 */
+    if ((start = find_fit(size + grain + 2*DSIZE)) == NULL) {
+        /* 堆尾是空闲块的话从它开始，否则从Epilogue开始 */
+        start = PREV_BLKP(brk);
+        if (GET_ALLOC(HDRP(start)))
+            start = brk;
+    }
+    pad = ((uintptr_t)ptr - (uintptr_t)start) & (grain - 1);
+    if (pad != 0 && pad < 2*DSIZE)
+        pad += grain;             // 空隙至少要放得下一个最小的空闲块
+    bp = start + pad;
+
+    if (start == brk || bp + size > start + GET_SIZE(HDRP(start))) {
+        /* 只可能是在堆尾：不够的部分用sbrk补上 */
+        if (mem_sbrk(bp + size - brk) == (void *)-1)
+            return NULL;
+        total = pad + size;
+        PUT(HDRP(bp + size), PACK(0, 1)); // New epilogue header
+    }
+    else
+        total = GET_SIZE(HDRP(start));
+    if (start != brk) {
+        segragated_list_delete(start);
+        unmark_dirty(start);
+    }
+
+    /* 剩下的尾巴太小就一起给新块 */
+    rest = total - pad - size;
+    if (rest < 2*DSIZE) {
+        size += rest;
+        rest = 0;
+    }
+    PUT(HDRP(bp), PACK(size, 1));
+    PUT(FTRP(bp), PACK(size, 1));
+    if (rest) {
+        char *tail = NEXT_BLKP(bp);
+        PUT(HDRP(tail), PACK(rest, 0));
+        PUT(FTRP(tail), PACK(rest, 0));
+        PUT_PRED(tail, 0);
+        PUT_SUCC(tail, 0);
+        coalesce(tail);
+    }
+    if (pad) {
+        PUT(HDRP(start), PACK(pad, 0));
+        PUT(FTRP(start), PACK(pad, 0));
+        PUT_PRED(start, 0);
+        PUT_SUCC(start, 0);
+        coalesce(start);
+    }
+
+    /* 对齐之前和最后不满一个grain的部分还是复制 */
+    n = GET_SIZE(HDRP(ptr)) - DSIZE;
+    head = (grain - ((uintptr_t)ptr & (grain - 1))) & (grain - 1);
+    if (head > n)
+        head = n;
+    mid = (n - head) & ~(grain - 1);
+    memcpy(bp, ptr, head);
+    if (mid && mem_remap(bp + head, (char *)ptr + head, mid) < 0)
+        memcpy(bp + head, (char *)ptr + head, mid);
+    memcpy(bp + head + mid, (char *)ptr + head + mid, n - head - mid);
+
+    free(ptr);
+    mark_dirty(bp);
+    return bp;
+}
+
 /* coalesce - 把一个空闲块和他的前后块合并 */
 static void *coalesce(void *ptr) {
     // printf("coalesce called by %p\n", ptr);
@@ -391,6 +662,7 @@ static void *coalesce(void *ptr) {
         /* 这里删除掉next和ptr在链表中的，为了后面加入新的空闲块 */
         segragated_list_delete(next);
         segragated_list_delete(ptr);
+        unmark_dirty(next);
         PUT(HDRP(ptr), PACK(size, 0));
         PUT(FTRP(ptr), PACK(size, 0));
     }
@@ -400,6 +672,7 @@ static void *coalesce(void *ptr) {
         /* 这里删除掉prev和ptr在链表中的，为了后面加入新的空闲块 */
         segragated_list_delete(prev);
         segragated_list_delete(ptr);
+        unmark_dirty(ptr);
         PUT(FTRP(ptr), PACK(size, 0));
         PUT(HDRP(prev), PACK(size, 0));
         ptr = prev;
@@ -411,6 +684,8 @@ static void *coalesce(void *ptr) {
         segragated_list_delete(prev);
         segragated_list_delete(next);
         segragated_list_delete(ptr);
+        unmark_dirty(ptr);
+        unmark_dirty(next);
         PUT(HDRP(prev), PACK(size, 0));
         PUT(FTRP(next), PACK(size, 0));
         ptr = prev;
@@ -418,30 +693,21 @@ static void *coalesce(void *ptr) {
 
     /* 合并之后我们要把这个块加入到链表中去 */
     segragated_list_insert(ptr);
+    mark_dirty(ptr);
     return ptr;
 }
 
 /* segragated_list_search - 找到当前的大小对应的大小块链表的头指针 */
 static void *segragated_list_search(size_t size) {
     /* 这里我们要找到一个合适的大小类 */
-    int i = 0;
+    int i = MM_NCLASSES - 1;
     size_t adjusted_size = size;
     if (adjusted_size <= DSIZE) adjusted_size = 2*DSIZE;
     else adjusted_size = ALIGN(size);
 
-    /* 大小类为>4096的大小块的头指针 */
-    if (adjusted_size >= 4096)
-        return segragated_listp + 8 * WSIZE;
-
-    /* 大小类为<=32的大小块的头指针 */
-    if (adjusted_size < 32)
-        return segragated_listp;
-    /* 大小类在两者之间的大小块的头指针 */
-    adjusted_size >>= 5; // 除以32，因为32-64是第二个大小类也就是i=1
-    while (adjusted_size >= 1) {
-        adjusted_size >>= 1;
-        i++;
-    }
+    /* 从最大的大小类往下找第一个下界不超过它的，mm_class_lo[0]是0 */
+    while (adjusted_size < mm_class_lo[i])
+        i--;
     return segragated_listp + i * WSIZE;
 }
 
@@ -450,6 +716,30 @@ static void segragated_list_insert(void *ptr) {
     if (ptr == NULL) return;
     size_t size = GET_SIZE(HDRP(ptr));
     void *head = segragated_list_search(size);
+    int b = ((char *)head - segragated_listp) / WSIZE;
+
+    /* 有索引的话在索引里找位置，前后的块直接从索引里拿 */
+    if (index_len[b] < INDEX_CAP) {
+        int n = index_len[b];
+        int pos = index_above(index_size[b], n, size);
+        void *prev = pos == 0 ? head : GET_PTR(index_off[b][pos - 1]);
+        void *next = pos == n ? NULL : GET_PTR(index_off[b][pos]);
+
+        memmove(&index_size[b][pos + 1], &index_size[b][pos], (n - pos) * sizeof(unsigned int));
+        memmove(&index_off[b][pos + 1], &index_off[b][pos], (n - pos) * sizeof(unsigned int));
+        index_size[b][pos] = size;
+        index_off[b][pos] = GET_BIAS(ptr);
+        index_len[b]++;
+
+        if (prev == head) PUT(head, GET_BIAS(ptr));
+        else PUT_SUCC(prev, GET_BIAS(ptr));
+        PUT_PRED(ptr, GET_BIAS(prev));
+        PUT_SUCC(ptr, GET_BIAS(next));
+        if (next != NULL) PUT_PRED(next, GET_BIAS(ptr));
+        return;
+    }
+    if (index_len[b] == INDEX_CAP)
+        index_len[b]++; // 索引满了，这个大小类以后走链表
     // printf("segragated_list_insert called by %p\n", ptr);
     // printf("head = %p\n", head);
     /* 如果这个链表是空的，那么就直接插入 */
@@ -508,6 +798,20 @@ static void segragated_list_delete(void *ptr) {
     }
     PUT_PRED(ptr, 0);
     PUT_SUCC(ptr, 0);
+
+    /* 索引里它在一样大的那些块中间，先跳过比它大的，再按偏移找 */
+    int b = ((char *)head - segragated_listp) / WSIZE;
+    if (index_len[b] <= INDEX_CAP) {
+        int n = index_len[b];
+        int pos = index_find(index_off[b],
+                             index_above(index_size[b], n, GET_SIZE(HDRP(ptr))),
+                             n, GET_BIAS(ptr));
+        if (pos >= 0) {
+            memmove(&index_size[b][pos], &index_size[b][pos + 1], (n - pos - 1) * sizeof(unsigned int));
+            memmove(&index_off[b][pos], &index_off[b][pos + 1], (n - pos - 1) * sizeof(unsigned int));
+            index_len[b]--;
+        }
+    }
     
     if (pred == head) {
         PUT(head, GET_BIAS(succ));
@@ -526,17 +830,24 @@ static void *find_fit(size_t size) {
     // printf("find_fit called by %ld\n", size);
     /* 总的说来，就是先在自己的大小类链表里面找，有可能找不到的话去更高的大小类里面找 */
     void *head = segragated_list_search(size);
+    int b = ((char *)head - segragated_listp) / WSIZE;
     // printf("segragated_list_search(size) = %p\n", head);
     // printf("head = %p\n", head);
     void *cur = GET_PTR(GET(head));
     // printf("cur = %p\n", cur);
-    while (cur != NULL) {
-        if (size <= GET_SIZE(HDRP(cur))) return cur;
-        cur = GET_PTR(SUCC(cur));
+    if (index_len[b] <= INDEX_CAP) {
+        /* 链表从大到小，第一个放不下就都放不下，看索引的第一项就够了 */
+        if (index_len[b] > 0 && index_size[b][0] >= size) return cur;
+    }
+    else {
+        while (cur != NULL) {
+            if (size <= GET_SIZE(HDRP(cur))) return cur;
+            cur = GET_PTR(SUCC(cur));
+        }
     }
     /* 如果在自己的大小类里面找不到，就去更高的大小类里面找 */
     head = (void *)((char *)head + WSIZE);
-    while (head != segragated_listp + 9 * WSIZE) {
+    while (head != segragated_listp + MM_NCLASSES * WSIZE) {
         cur = GET_PTR(GET(head));
         // printf("head = %p\n", head);
         // printf("cur = %p\n", cur);
@@ -549,6 +860,40 @@ static void *find_fit(size_t size) {
     return NULL; // 上面的都找不到，那么肯定是返回NULL了
 }
 
+/* index_above - 从大到小排好的a[0..n)里比x大的有几个，也就是x该插在哪里。
+ * 块大小都小于2^31，所以可以用有符号的比较 */
+static int index_above(const unsigned int *a, int n, unsigned int x) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128i v = _mm_set1_epi32((int)x);
+    for (; i + 4 <= n; i += 4) {
+        __m128i gt = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(a + i)), v);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(gt));
+        if (mask != 0xf)
+            return i + __builtin_popcount(mask); // 比x大的都在前面
+    }
+#endif
+    while (i < n && a[i] > x) i++;
+    return i;
+}
+
+/* index_find - a[from..n)里第一个等于x的下标，没有的话返回-1 */
+static int index_find(const unsigned int *a, int from, int n, unsigned int x) {
+    int i = from;
+#ifdef __SSE2__
+    __m128i v = _mm_set1_epi32((int)x);
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(a + i)), v);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++)
+        if (a[i] == x) return i;
+    return -1;
+}
+
 /* place - 把一个块放到合适的位置 */
 static void place(void *ptr, size_t size) {
     // printf("place called by %p, %ld\n", ptr, size);
@@ -558,7 +903,7 @@ static void place(void *ptr, size_t size) {
     segragated_list_delete(ptr);
 
     /* 如果这个块的大小比我们要求的大，那么就要分割这个块 */
-    if (ptr_size > size) {
+    if (ptr_size - size >= MM_SPLIT_MIN) {
         /* 我们的长度计算都是包括Header和Footer的 */
         PUT(HDRP(ptr), PACK(size, 1));
         PUT(FTRP(ptr), PACK(size, 1));
@@ -576,8 +921,9 @@ static void place(void *ptr, size_t size) {
         PUT(HDRP(ptr), PACK(ptr_size, 1));
         PUT(FTRP(ptr), PACK(ptr_size, 1));
     }
+    mark_dirty(ptr);
     // printf("\n");
     // printf("check the heap after place\n");
     // mm_checkheap(561);
     // printf("\n");
-}
\ No newline at end of file
+}
@@ -1,14 +1,16 @@
 #include <stdio.h>
 
-#ifdef DRIVER
-
-/* declare functions for driver tests */
+/*
+ * Compiled with -DDRIVER, the allocators name their functions mm_*.
+ * That is how mdriver links them, and also how mm-shared.c wraps mm.c
+ * to make libmm.so.
+ */
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
 
-#else
+#ifndef DRIVER
 
 /* declare functions for interpositioning */
 extern void *malloc (size_t size);
@@ -20,5 +22,20 @@ extern void *calloc (size_t nmemb, size_t size);
 
 extern int mm_init(void);
 
-/* This is largely for debugging. */
-extern void mm_checkheap(int lineno);
+/*
+ * Check the heap's invariants; returns the number of errors found, and
+ * prints only about those. It may check only what changed since the
+ * last call, so it is cheap enough to call before every request.
+ */
+extern int mm_checkheap(int lineno);
+
+/* Total bytes in free blocks, and the size of the largest free block */
+extern void mm_heapstats(size_t *free_bytes, size_t *largest_free);
+
+/*
+ * Call fn once for every block in the heap, in address order. offset is
+ * the payload's distance from mem_heap_lo(), size the whole block with
+ * any header and footer. No I/O, and no allocation.
+ */
+typedef void (*mm_walk_fn)(void *arg, size_t offset, size_t size, int alloc);
+extern void mm_heapwalk(mm_walk_fn fn, void *arg);
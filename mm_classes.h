@@ -0,0 +1,24 @@
+/*
+ * mm_classes.h - size classes of mm.c's segregated free lists
+ *
+ * The default: powers of two from 32 to 4096. Regenerate it with
+ *     ./mmclasses -d -o mm_classes.h
+ * or fit it to a workload with
+ *     ./mmclasses -o mm_classes.h <trace.rep>...
+ */
+#ifndef __MM_CLASSES_H_
+#define __MM_CLASSES_H_
+
+#define MM_NCLASSES 9
+
+/* Class i holds free blocks of mm_class_lo[i] bytes up to the next
+   class's bound; the last class has no upper bound */
+static const unsigned int mm_class_lo[MM_NCLASSES] = {
+    0, 32, 64, 128, 256, 512, 1024, 2048,
+    4096
+};
+
+/* place splits a block only if at least this many bytes are left */
+#define MM_SPLIT_MIN 16
+
+#endif /* __MM_CLASSES_H_ */
@@ -0,0 +1,75 @@
+/*
+ * mm_fast.h - Fast paths into mm.c for blocks of a size known at
+ *     compile time, such as the nodes of a list or tree:
+ *
+ *     struct node *n = mm_fast_malloc(sizeof(struct node));
+ *     ...
+ *     mm_fast_free(n, sizeof(struct node));
+ *
+ * Every block size up to MM_FAST_MAX_BLOCK has a LIFO list of blocks
+ * given back through mm_fast_free. mm.c still counts those blocks as
+ * allocated, so taking one skips malloc's size adjustment, the class
+ * search and place altogether. With a constant size the class folds
+ * at compile time, and both calls inline to a few loads and stores. A
+ * list holds at most MM_FAST_CAP blocks; beyond that, and for larger
+ * sizes, the calls fall through to mm_malloc and mm_free. mm_init
+ * empties the lists, since the heap they point into is gone.
+ *
+ * Give a block back with the size it was allocated with, and only
+ * once: mm_free followed by mm_fast_free would hand it out twice. Like
+ * mm.c itself, this is single-threaded.
+ */
+#ifndef __MM_FAST_H_
+#define __MM_FAST_H_
+
+#include <stddef.h>
+#include "mm.h"
+
+#define MM_FAST_MAX_BLOCK 64    /* largest block with a fast path */
+#define MM_FAST_CLASSES   (MM_FAST_MAX_BLOCK / 8 - 1)  /* 16, 24, ..., 64 */
+#define MM_FAST_CAP       256   /* most blocks kept per class */
+
+/* The block mm_malloc carves for a payload of n bytes, and its class */
+#define MM_FAST_BLOCK(n)  ((n) <= 8 ? (size_t)16 : ((size_t)(n) + 8 + 7) & ~(size_t)7)
+#define MM_FAST_CLASS(n)  (MM_FAST_BLOCK(n) / 8 - 2)
+
+/* Defined in mm.c */
+extern void *mm_fast_list[MM_FAST_CLASSES];
+extern unsigned int mm_fast_count[MM_FAST_CLASSES];
+
+static inline __attribute__((always_inline)) void *mm_fast_malloc(size_t n)
+{
+    size_t c;
+    void *p;
+
+    if (n == 0 || MM_FAST_BLOCK(n) > MM_FAST_MAX_BLOCK)
+        return mm_malloc(n);
+    c = MM_FAST_CLASS(n);
+    if ((p = mm_fast_list[c]) == NULL)
+        return mm_malloc(n);
+    mm_fast_list[c] = *(void **)p;
+    mm_fast_count[c]--;
+    return p;
+}
+
+static inline __attribute__((always_inline)) void mm_fast_free(void *p, size_t n)
+{
+    size_t c;
+
+    if (p == NULL)
+        return;
+    if (n == 0 || MM_FAST_BLOCK(n) > MM_FAST_MAX_BLOCK) {
+        mm_free(p);
+        return;
+    }
+    c = MM_FAST_CLASS(n);
+    if (mm_fast_count[c] >= MM_FAST_CAP) {
+        mm_free(p);
+        return;
+    }
+    *(void **)p = mm_fast_list[c];
+    mm_fast_list[c] = p;
+    mm_fast_count[c]++;
+}
+
+#endif /* __MM_FAST_H_ */
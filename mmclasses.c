@@ -0,0 +1,367 @@
+/*
+ * mmclasses.c - Choose mm.c's size classes from the block sizes that
+ *     one or more .rep traces request, and write them as mm_classes.h.
+ *
+ * usage: mmclasses [options] <trace.rep>...
+ *
+ * Every alloc and realloc counts once, at the block size mm.c gives it
+ * (payload plus header and footer, 8-byte aligned, at least 16). The
+ * default classes, powers of two from 32 to 4096, stay; the extra ones
+ * start at requested sizes, so a hot size gets a class of its own.
+ * Without the default bounds the profile would leave the large sizes in
+ * one wide class, where find_fit always hands out the largest free
+ * block in the heap and util suffers. A dynamic program picks the extra
+ * boundaries that minimize the sum over classes of
+ *
+ *     fragmentation  sum of w(s) * (hi - s) / hi over the sizes s in the
+ *                    class, hi the largest block it can hold: what a
+ *                    request gives up when find_fit hands it the largest
+ *                    block there
+ *   + search length  alpha * W^2 / total, W the requests in the class:
+ *                    how long its list gets, relative to the others
+ *
+ * The last class is open-ended and holds everything above. Remainders
+ * smaller than any requested block cannot serve a request until they
+ * coalesce, so place keeps them in the block instead of splitting.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CLASSES 64          /* the list heads live in the heap prologue */
+#define MAX_CUTS    1024        /* sizes the dynamic program may start a class at */
+#define MIN_BLOCK   16
+#define NUM_DEFAULT 9           /* classes of the default header */
+
+typedef struct {
+    unsigned int size;          /* block size */
+    double count;               /* requests for it */
+    int fixed;                  /* a default bound, always starts a class */
+} size_count_t;
+
+static size_count_t *sizes;
+static int num_sizes, cap_sizes;
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mmclasses: %s %s\n", msg, arg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mmclasses [options] <trace.rep>...\n");
+    fprintf(stderr, "  -n <classes>  Number of size classes, the %d default ones included\n", NUM_DEFAULT);
+    fprintf(stderr, "                (default 16, at most %d)\n", MAX_CLASSES);
+    fprintf(stderr, "  -a <alpha>    Weight of search length against fragmentation (default 1)\n");
+    fprintf(stderr, "  -o <file>     Write the header here instead of to stdout\n");
+    fprintf(stderr, "  -d            Write the default header: powers of two from 32 to 4096\n");
+    exit(1);
+}
+
+/* default_lo - where default class i starts */
+static unsigned int default_lo(int i)
+{
+    return i == 0 ? 0 : 16u << i;
+}
+
+/* block_size - the block mm.c's malloc carves for a payload of n bytes */
+static unsigned int block_size(unsigned int n)
+{
+    if (n <= 8)
+        return MIN_BLOCK;
+    return (n + 8 + 7) & ~7u;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+    unsigned int x = ((const size_count_t *)a)->size;
+    unsigned int y = ((const size_count_t *)b)->size;
+    return (x > y) - (x < y);
+}
+
+/* add_size - append count requests for a block of size bytes */
+static void add_size(unsigned int size, double count, int fixed)
+{
+    if (num_sizes == cap_sizes) {
+        cap_sizes = cap_sizes ? 2 * cap_sizes : 4096;
+        if ((sizes = realloc(sizes, cap_sizes * sizeof(*sizes))) == NULL)
+            die("out of memory", "");
+    }
+    sizes[num_sizes].size = size;
+    sizes[num_sizes].count = count;
+    sizes[num_sizes].fixed = fixed;
+    num_sizes++;
+}
+
+static double *by_count;        /* for cmp_count */
+
+static int cmp_count(const void *a, const void *b)
+{
+    double x = by_count[*(const int *)a];
+    double y = by_count[*(const int *)b];
+    return (x < y) - (x > y);
+}
+
+/*
+ * read_trace - Count the block sizes requested by the trace in name.
+ *     Sizes are appended unsorted; main merges the duplicates.
+ */
+static void read_trace(const char *name)
+{
+    FILE *f;
+    int weight, num_ids, num_ops, ignore_ranges, id;
+    unsigned int size = 0;
+    char type[64];
+
+    if ((f = fopen(name, "r")) == NULL)
+        die("could not open", name);
+    if (fscanf(f, "%d %d %d %d", &weight, &num_ids, &num_ops,
+               &ignore_ranges) != 4)
+        die("bad trace header in", name);
+
+    while (fscanf(f, "%63s", type) == 1) {
+        /* as in mdriver's read_trace, a missing size repeats the last one */
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(f, "%d %u", &id, &size) < 1)
+                die("truncated op in", name);
+            break;
+        case 'f':
+            if (fscanf(f, "%d", &id) != 1)
+                die("truncated free in", name);
+            continue;
+        case '@':               /* thread of the next op */
+        case 'b':               /* barrier */
+            continue;
+        default:
+            die("bogus op type in", name);
+        }
+        add_size(block_size(size), 1, 0);
+    }
+    fclose(f);
+}
+
+/* merge - Sort the sizes and fold duplicates into one entry each */
+static void merge(void)
+{
+    int i, n = 0;
+
+    qsort(sizes, num_sizes, sizeof(*sizes), cmp_size);
+    for (i = 0; i < num_sizes; i++) {
+        if (n > 0 && sizes[n - 1].size == sizes[i].size) {
+            sizes[n - 1].count += sizes[i].count;
+            sizes[n - 1].fixed |= sizes[i].fixed;
+        } else
+            sizes[n++] = sizes[i];
+    }
+    num_sizes = n;
+}
+
+/*
+ * top - The largest free block a class ending before sizes[end] can
+ *     hold, or the largest size requested for the open-ended last class
+ */
+static double top(int end)
+{
+    if (end == num_sizes)
+        return sizes[num_sizes - 1].size;
+    return sizes[end].size - 8;
+}
+
+/*
+ * choose - Pick n class boundaries among the sizes, the fixed ones
+ *     included. lo[0] is 0, and lo[i] is the size class i starts at.
+ *     Returns the number of classes, which is less than n if the traces
+ *     have too few sizes. n is at least NUM_DEFAULT, so there are always
+ *     enough classes for the fixed bounds.
+ */
+static int choose(int n, double alpha, unsigned int *lo)
+{
+    double *w, *ws, total;
+    double *best;               /* best[k * m + j]: k+1 classes over sizes [0, cut[j]), -1 if none */
+    int *from, *cut, *order;
+    char *start;                /* may sizes[i] start a class? */
+    int m, i, j, k, a;
+
+    /* prefix sums of the counts, and of count * size */
+    w = calloc(num_sizes + 1, sizeof(double));
+    ws = calloc(num_sizes + 1, sizeof(double));
+    start = calloc(num_sizes, 1);
+    order = malloc(num_sizes * sizeof(int));
+    cut = malloc((num_sizes + 1) * sizeof(int));
+    if (w == NULL || ws == NULL || start == NULL || order == NULL || cut == NULL)
+        die("out of memory", "");
+    for (i = 0; i < num_sizes; i++) {
+        w[i + 1] = w[i] + sizes[i].count;
+        ws[i + 1] = ws[i] + sizes[i].count * sizes[i].size;
+    }
+    total = w[num_sizes];
+
+    /* Classes may start at the fixed bounds and the most requested sizes */
+    if ((by_count = malloc(num_sizes * sizeof(double))) == NULL)
+        die("out of memory", "");
+    for (i = 0; i < num_sizes; i++) {
+        order[i] = i;
+        by_count[i] = sizes[i].count;
+    }
+    qsort(order, num_sizes, sizeof(int), cmp_count);
+    for (i = 0; i < num_sizes; i++)
+        start[i] = sizes[i].fixed;
+    for (i = 0; i < num_sizes && i < MAX_CUTS; i++)
+        start[order[i]] = 1;
+    m = 0;
+    cut[m++] = 0;
+    for (i = 1; i < num_sizes; i++)
+        if (start[i])
+            cut[m++] = i;
+    cut[m++] = num_sizes;
+    if (n > m - 1)
+        n = m - 1;
+
+    best = malloc((size_t)n * m * sizeof(double));
+    from = malloc((size_t)n * m * sizeof(int));
+    if (best == NULL || from == NULL)
+        die("out of memory", "");
+
+#define COST(x, y) (w[cut[y]] - w[cut[x]]                                    \
+                    - (ws[cut[y]] - ws[cut[x]]) / top(cut[y])                 \
+                    + alpha * (w[cut[y]] - w[cut[x]]) * (w[cut[y]] - w[cut[x]]) / total)
+
+    /* A class may not reach past a fixed bound, so each walk back over
+       the possible starts a of a class ending at cut[j] stops at one */
+    for (j = 1; j < m; j++) {
+        best[j] = COST(0, j);
+        from[j] = 0;
+        if (j > 1 && (best[j - 1] < 0 || sizes[cut[j - 1]].fixed))
+            best[j] = -1;
+    }
+    for (k = 1; k < n; k++) {
+        for (j = 0; j < m; j++) {
+            best[k * m + j] = -1;
+            for (a = j - 1; a >= k; a--) {
+                double prev = best[(k - 1) * m + a];
+                if (prev >= 0) {
+                    double c = prev + COST(a, j);
+                    if (best[k * m + j] < 0 || c < best[k * m + j]) {
+                        best[k * m + j] = c;
+                        from[k * m + j] = a;
+                    }
+                }
+                if (sizes[cut[a]].fixed)
+                    break;
+            }
+        }
+    }
+#undef COST
+
+    /* Walk back from the class that ends at the last size */
+    for (k = n - 1, j = m - 1; k >= 0; k--) {
+        j = from[k * m + j];
+        lo[k] = k == 0 ? 0 : sizes[cut[j]].size;
+    }
+
+    free(w);
+    free(ws);
+    free(start);
+    free(order);
+    free(cut);
+    free(by_count);
+    free(best);
+    free(from);
+    return n;
+}
+
+static void write_header(FILE *out, int n, const unsigned int *lo,
+                         unsigned int split_min, int argc, char **argv)
+{
+    int i;
+
+    fprintf(out, "/*\n");
+    fprintf(out, " * mm_classes.h - size classes of mm.c's segregated free lists\n");
+    fprintf(out, " *\n");
+    if (argc == 0) {
+        fprintf(out, " * The default: powers of two from 32 to 4096. Regenerate it with\n");
+        fprintf(out, " *     ./mmclasses -d -o mm_classes.h\n");
+        fprintf(out, " * or fit it to a workload with\n");
+        fprintf(out, " *     ./mmclasses -o mm_classes.h <trace.rep>...\n");
+    } else {
+        fprintf(out, " * Generated by mmclasses from\n");
+        for (i = 0; i < argc; i++)
+            fprintf(out, " *     %s\n", argv[i]);
+    }
+    fprintf(out, " */\n");
+    fprintf(out, "#ifndef __MM_CLASSES_H_\n");
+    fprintf(out, "#define __MM_CLASSES_H_\n\n");
+    fprintf(out, "#define MM_NCLASSES %d\n\n", n);
+    fprintf(out, "/* Class i holds free blocks of mm_class_lo[i] bytes up to the next\n");
+    fprintf(out, "   class's bound; the last class has no upper bound */\n");
+    fprintf(out, "static const unsigned int mm_class_lo[MM_NCLASSES] = {");
+    for (i = 0; i < n; i++)
+        fprintf(out, "%s%s%u", i ? "," : "", i % 8 ? " " : "\n    ", lo[i]);
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "/* place splits a block only if at least this many bytes are left */\n");
+    fprintf(out, "#define MM_SPLIT_MIN %u\n\n", split_min);
+    fprintf(out, "#endif /* __MM_CLASSES_H_ */\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int lo[MAX_CLASSES], split_min = MIN_BLOCK;
+    int n = 16, defaults = 0, c, i;
+    double alpha = 1;
+    char *outname = NULL;
+    FILE *out = stdout;
+
+    while ((c = getopt(argc, argv, "n:a:o:dh")) != EOF) {
+        switch (c) {
+        case 'n':
+            n = atoi(optarg);
+            if (n < NUM_DEFAULT || n > MAX_CLASSES)
+                die("bad number of classes", optarg);
+            break;
+        case 'a':
+            alpha = atof(optarg);
+            if (alpha < 0)
+                die("bad alpha", optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'd':
+            defaults = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (defaults) {
+        n = NUM_DEFAULT;
+        for (i = 0; i < n; i++)
+            lo[i] = default_lo(i);
+        argc = optind;
+    } else {
+        if (optind == argc)
+            usage();
+        for (i = optind; i < argc; i++)
+            read_trace(argv[i]);
+        if (num_sizes == 0)
+            die("no allocations in", argv[optind]);
+        merge();
+        split_min = sizes[0].size;
+        for (i = 1; i < NUM_DEFAULT; i++)
+            add_size(default_lo(i), 0, 1);
+        merge();
+        n = choose(n, alpha, lo);
+    }
+
+    if (outname && (out = fopen(outname, "w")) == NULL)
+        die("could not write", outname);
+    write_header(out, n, lo, split_min, argc - optind, argv + optind);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
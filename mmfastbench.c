@@ -0,0 +1,101 @@
+/*
+ * mmfastbench.c - Compare mm_malloc/mm_free with the fast paths of
+ *     mm_fast.h on fixed-size nodes.
+ *
+ * usage: mmfastbench
+ *
+ * For each node size, a round allocates a batch of nodes and frees
+ * them newest first, over and over; fcyc times the rounds. A batch of
+ * 100 fits in mm_fast.h's lists, one of 1000 overflows them, so part of
+ * it goes through mm_malloc and mm_free anyway. The heap is set up
+ * afresh before each measurement. Every size is a compile-time
+ * constant at the mm_fast_* calls, as it would be in real code.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mm.h"
+#include "mm_fast.h"
+#include "memlib.h"
+#include "fcyc.h"
+#include "clock.h"
+
+#define ROUNDS    20
+#define MAX_BATCH 1000
+
+typedef struct {
+    int batch;
+    int fast;
+} bench_t;
+
+static void *nodes[MAX_BATCH];
+
+/*
+ * Each size gets its own round function so that mm_fast_malloc sees a
+ * constant, the way a caller allocating sizeof(struct node) would.
+ */
+#define ROUND_FN(n)                                                     \
+static void round_##n(void *arg)                                        \
+{                                                                       \
+    bench_t *b = arg;                                                   \
+    int r, i;                                                           \
+                                                                        \
+    for (r = 0; r < ROUNDS; r++) {                                      \
+        if (b->fast) {                                                  \
+            for (i = 0; i < b->batch; i++)                              \
+                nodes[i] = mm_fast_malloc(n);                           \
+            for (i = b->batch - 1; i >= 0; i--)                         \
+                mm_fast_free(nodes[i], n);                              \
+        } else {                                                        \
+            for (i = 0; i < b->batch; i++)                              \
+                nodes[i] = mm_malloc(n);                                \
+            for (i = b->batch - 1; i >= 0; i--)                         \
+                mm_free(nodes[i]);                                      \
+        }                                                               \
+    }                                                                   \
+}
+
+ROUND_FN(16)
+ROUND_FN(24)
+ROUND_FN(32)
+ROUND_FN(48)
+
+static struct {
+    int size;
+    test_funct round;
+} sizes[] = {
+    {16, round_16}, {24, round_24}, {32, round_32}, {48, round_48},
+};
+
+/* measure - Cycles per malloc and free pair of one size and batch */
+static double measure(test_funct round, int batch, int fast)
+{
+    bench_t b = {batch, fast};
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mmfastbench: mm_init failed\n");
+        exit(1);
+    }
+    return fcyc(round, &b) / ((double)ROUNDS * batch);
+}
+
+int main(void)
+{
+    static const int batches[] = {100, MAX_BATCH};
+    size_t i, j;
+
+    mem_init();
+    printf("Cycles per malloc and free pair:\n");
+    printf("%6s %6s %10s %10s %8s\n", "size", "batch", "mm_malloc", "mm_fast", "speedup");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (j = 0; j < sizeof(batches) / sizeof(batches[0]); j++) {
+            double slow = measure(sizes[i].round, batches[j], 0);
+            double fast = measure(sizes[i].round, batches[j], 1);
+            printf("%6d %6d %10.1f %10.1f %7.1fx\n", sizes[i].size,
+                   batches[j], slow, fast, slow / fast);
+        }
+    }
+    mem_deinit();
+    return 0;
+}
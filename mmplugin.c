@@ -0,0 +1,151 @@
+/*
+ * mmplugin.c - allocators that mdriver loads at run time, see mmplugin.h
+ */
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "memlib.h"
+#include "mmplugin.h"
+
+static char error[256];
+
+static void no_heapstats(size_t *free_bytes, size_t *largest_free)
+{
+    *free_bytes = 0;
+    *largest_free = 0;
+}
+
+static void no_heapwalk(mm_walk_fn fn, void *arg)
+{
+}
+
+void mmplugin_builtin(allocator_t *a)
+{
+    memset(a, 0, sizeof(*a));
+    strcpy(a->name, "mm");
+    a->init = mm_init;
+    a->malloc = mm_malloc;
+    a->free = mm_free;
+    a->realloc = mm_realloc;
+    a->calloc = mm_calloc;
+    a->checkheap = mm_checkheap;
+    a->heapstats = mm_heapstats;
+    a->heapwalk = mm_heapwalk;
+}
+
+/*
+ * The null allocator. It never calls mem_sbrk: the bump pointer walks
+ * memlib's heap from its start and wraps around at MAX_HEAP, since
+ * speed runs never look at what is in the blocks.
+ */
+static char *null_brk;
+
+static int null_init(void)
+{
+    null_brk = mem_heap_lo();
+    return 0;
+}
+
+static void *null_malloc(size_t size)
+{
+    char *lo = mem_heap_lo();
+    char *p;
+
+    size = (size + 7) & ~(size_t)7;
+    if (size > MAX_HEAP)
+        return NULL;
+    if (size > (size_t)(lo + MAX_HEAP - null_brk))
+        null_brk = lo;
+    p = null_brk;
+    null_brk += size;
+    return p;
+}
+
+static void null_free(void *ptr)
+{
+}
+
+static void *null_realloc(void *ptr, size_t size)
+{
+    return null_malloc(size);
+}
+
+static int null_checkheap(int lineno)
+{
+    return 0;
+}
+
+void mmplugin_null(allocator_t *a)
+{
+    memset(a, 0, sizeof(*a));
+    strcpy(a->name, "null");
+    a->init = null_init;
+    a->malloc = null_malloc;
+    a->free = null_free;
+    a->realloc = null_realloc;
+    a->checkheap = null_checkheap;
+    a->heapstats = no_heapstats;
+    a->heapwalk = no_heapwalk;
+}
+
+/*
+ * lookup - dlsym that records which symbol was missing
+ */
+static void *lookup(allocator_t *a, const char *path, const char *sym)
+{
+    void *p = dlsym(a->handle, sym);
+
+    if (p == NULL)
+        snprintf(error, sizeof(error), "%s does not define %s", path, sym);
+    return p;
+}
+
+int mmplugin_load(allocator_t *a, const char *path)
+{
+    const char *base = strrchr(path, '/');
+    size_t len;
+
+    memset(a, 0, sizeof(*a));
+    base = base ? base + 1 : path;
+    len = strlen(base);
+    if (len > 3 && strcmp(base + len - 3, ".so") == 0)
+        len -= 3;
+    if (len >= sizeof(a->name))
+        len = sizeof(a->name) - 1;
+    memcpy(a->name, base, len);
+
+    /* dlopen only searches the current directory for names with a / */
+    if (strchr(path, '/') == NULL) {
+        char local[1024];
+        snprintf(local, sizeof(local), "./%s", path);
+        a->handle = dlopen(local, RTLD_NOW | RTLD_LOCAL);
+    } else {
+        a->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    if (a->handle == NULL) {
+        snprintf(error, sizeof(error), "%s", dlerror());
+        return -1;
+    }
+
+    if ((a->init = lookup(a, path, "mm_init")) == NULL ||
+        (a->malloc = lookup(a, path, "mm_malloc")) == NULL ||
+        (a->free = lookup(a, path, "mm_free")) == NULL ||
+        (a->realloc = lookup(a, path, "mm_realloc")) == NULL ||
+        (a->checkheap = lookup(a, path, "mm_checkheap")) == NULL) {
+        dlclose(a->handle);
+        a->handle = NULL;
+        return -1;
+    }
+    a->calloc = dlsym(a->handle, "mm_calloc");
+    if ((a->heapstats = dlsym(a->handle, "mm_heapstats")) == NULL)
+        a->heapstats = no_heapstats;
+    if ((a->heapwalk = dlsym(a->handle, "mm_heapwalk")) == NULL)
+        a->heapwalk = no_heapwalk;
+    return 0;
+}
+
+const char *mmplugin_error(void)
+{
+    return error;
+}
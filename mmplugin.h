@@ -0,0 +1,49 @@
+/*
+ * mmplugin.h - allocators that mdriver loads at run time (-a)
+ *
+ * A plug-in is an mm*.c allocator built as a shared object with
+ * -DDRIVER, so it exports the usual mm_* functions. Its mem_sbrk and
+ * friends resolve to mdriver's memlib, which mdriver exports with
+ * -rdynamic, and it is linked with -Bsymbolic so that its calls to its
+ * own mm_* functions do not bind to the copies linked into mdriver.
+ */
+#ifndef __MMPLUGIN_H_
+#define __MMPLUGIN_H_
+
+#include <stddef.h>
+#include "mm.h"
+
+typedef struct {
+    char name[64];               /* file name less any directory and .so */
+    void *handle;                /* from dlopen; NULL for the built-in one */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    int (*checkheap)(int lineno);
+    /* optional: calloc is NULL if missing, and the others are
+       stand-ins that report an empty heap */
+    void *(*calloc)(size_t nmemb, size_t size);
+    void (*heapstats)(size_t *free_bytes, size_t *largest_free);
+    void (*heapwalk)(mm_walk_fn fn, void *arg);
+} allocator_t;
+
+/* Fill in *a with the mm_* functions linked into this program */
+void mmplugin_builtin(allocator_t *a);
+
+/*
+ * Fill in *a with an allocator that does next to nothing: malloc bumps
+ * a pointer through memlib's heap and free is a no-op. Timing a trace
+ * against it measures what the driver itself costs per request.
+ */
+void mmplugin_null(allocator_t *a);
+
+/*
+ * Load the allocator in the shared object path into *a. Returns 0 on
+ * success, or -1 with a message in mmplugin_error().
+ */
+int mmplugin_load(allocator_t *a, const char *path);
+
+const char *mmplugin_error(void);
+
+#endif /* __MMPLUGIN_H_ */
@@ -0,0 +1,524 @@
+/*
+ * mtrace.c - LD_PRELOAD interposer that records a program's heap
+ *     requests as a .rep trace for mdriver.
+ *
+ * usage: unix> LD_PRELOAD=./libmtrace.so MTRACE_OUT=app.rep ./app
+ *
+ * malloc, calloc, realloc, free, memalign, posix_memalign and
+ * aligned_alloc are passed on to the next definitions (normally libc)
+ * and logged. Pointers are mapped to dense ids, reusing the ids of
+ * freed blocks, so num_ids stays near the peak number of live blocks.
+ * The log is kept in memory, in mmap'd space so recording never calls
+ * back into malloc, and written out when the program exits. Without
+ * MTRACE_OUT the trace goes to mtrace.<pid>.rep. A forked child starts
+ * an empty log of its own and writes it to <name>.<pid>.
+ *
+ * mdriver's malloc(0) fails on every allocator in the lab, so zero-byte
+ * requests are recorded as one byte. realloc(p, 0) is recorded as a
+ * free. Requests for pointers we never saw (from before the library
+ * was loaded) are not recorded.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define OP_ALLOC   'a'
+#define OP_REALLOC 'r'
+#define OP_FREE    'f'
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+    char type;
+} op_t;
+
+typedef struct {
+    uintptr_t ptr;             /* 0 marks an empty slot */
+    uint32_t id;
+} slot_t;
+
+/* The functions we interpose on */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int busy;          /* already inside one of our hooks */
+static int recording;              /* hooks resolved, log not yet written */
+static int resolving;              /* inside dlsym in mtrace_init */
+static pid_t first_pid;            /* the process we were loaded into */
+
+/* dlsym may calloc before real_calloc is known; serve it from here */
+static char boot_heap[4096] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static op_t *ops;
+static size_t num_ops, ops_cap;
+
+static slot_t *slots;
+static size_t slots_mask, num_slots_used;
+
+static uint32_t *free_ids;
+static size_t num_free_ids, free_ids_cap;
+static uint32_t next_id;
+
+/* Complain on stderr without going through stdio, which may malloc */
+static void say(const char *msg)
+{
+    ssize_t r = write(2, msg, strlen(msg));
+    (void)r;
+}
+
+/*
+ * grow_map - Grow an mmap'd array to at least want bytes. Recording
+ *     must not use malloc, so all of our own storage comes from here.
+ */
+static void *grow_map(void *p, size_t old, size_t want)
+{
+    void *q;
+
+    if (p == NULL)
+        q = mmap(NULL, want, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        q = mremap(p, old, want, MREMAP_MAYMOVE);
+    if (q == MAP_FAILED) {
+        say("mtrace: out of memory, recording stopped\n");
+        recording = 0;
+        return NULL;
+    }
+    return q;
+}
+
+static size_t hash_ptr(uintptr_t p)
+{
+    return (size_t)((p >> 4) * 0x9E3779B97F4A7C15ULL >> 20);
+}
+
+/* Rebuild the pointer table with twice as many slots */
+static void grow_slots(void)
+{
+    size_t old_n = slots ? slots_mask + 1 : 0;
+    size_t n = old_n ? 2 * old_n : 1 << 16;
+    slot_t *old = slots, *s;
+    size_t i, j;
+
+    if ((s = grow_map(NULL, 0, n * sizeof(slot_t))) == NULL)
+        return;
+    for (i = 0; i < old_n; i++) {
+        if (old[i].ptr == 0)
+            continue;
+        for (j = hash_ptr(old[i].ptr) & (n - 1); s[j].ptr; j = (j + 1) & (n - 1))
+            ;
+        s[j] = old[i];
+    }
+    if (old)
+        munmap(old, old_n * sizeof(slot_t));
+    slots = s;
+    slots_mask = n - 1;
+}
+
+/* Map ptr to id; returns id, or UINT32_MAX if we ran out of memory */
+static uint32_t bind_ptr(void *ptr, uint32_t id)
+{
+    size_t j;
+
+    if (slots == NULL || 2 * (num_slots_used + 1) > slots_mask + 1) {
+        grow_slots();
+        if (!recording)
+            return UINT32_MAX;
+    }
+    for (j = hash_ptr((uintptr_t)ptr) & slots_mask; slots[j].ptr;
+         j = (j + 1) & slots_mask)
+        ;
+    slots[j].ptr = (uintptr_t)ptr;
+    slots[j].id = id;
+    num_slots_used++;
+    return id;
+}
+
+/* Give a new block the lowest-cost id: a freed one if there is one */
+static uint32_t map_ptr(void *ptr)
+{
+    return bind_ptr(ptr, num_free_ids ? free_ids[--num_free_ids] : next_id++);
+}
+
+/*
+ * unmap_ptr - Forget ptr. Returns its id, or UINT32_MAX if ptr was
+ *     never recorded. Deletion shifts the rest of the probe run back,
+ *     so lookups never need tombstones.
+ */
+static uint32_t unmap_ptr(void *ptr)
+{
+    size_t i, j, k;
+    uint32_t id;
+
+    if (slots == NULL)
+        return UINT32_MAX;
+    for (i = hash_ptr((uintptr_t)ptr) & slots_mask; slots[i].ptr != (uintptr_t)ptr;
+         i = (i + 1) & slots_mask)
+        if (slots[i].ptr == 0)
+            return UINT32_MAX;
+    id = slots[i].id;
+
+    for (j = (i + 1) & slots_mask; slots[j].ptr; j = (j + 1) & slots_mask) {
+        k = hash_ptr(slots[j].ptr) & slots_mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].ptr = 0;
+    num_slots_used--;
+    return id;
+}
+
+/* Make a freed block's id available for reuse */
+static uint32_t release_id(uint32_t id)
+{
+    if (id == UINT32_MAX)
+        return id;
+    if (num_free_ids == free_ids_cap) {
+        size_t n = free_ids_cap ? 2 * free_ids_cap : 1 << 14;
+        uint32_t *f = grow_map(free_ids, free_ids_cap * sizeof(uint32_t),
+                               n * sizeof(uint32_t));
+        if (f == NULL)
+            return id;
+        free_ids = f;
+        free_ids_cap = n;
+    }
+    free_ids[num_free_ids++] = id;
+    return id;
+}
+
+static void log_op(char type, uint32_t id, size_t size)
+{
+    if (id == UINT32_MAX)
+        return;
+    if (num_ops == ops_cap) {
+        size_t n = ops_cap ? 2 * ops_cap : 1 << 16;
+        op_t *o = grow_map(ops, ops_cap * sizeof(op_t), n * sizeof(op_t));
+        if (o == NULL)
+            return;
+        ops = o;
+        ops_cap = n;
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].id = id;
+    ops[num_ops].size = size == 0 ? 1 : size > UINT_MAX ? UINT_MAX : (uint32_t)size;
+    num_ops++;
+}
+
+/*
+ * record - Log one request. old is the block being reallocated or
+ *     freed, p the block returned. Called with busy set and the lock
+ *     held.
+ */
+static void record(char type, void *old, void *p, size_t size)
+{
+    uint32_t id;
+
+    if (recording) {
+        switch (type) {
+        case OP_ALLOC:
+            if (p)
+                log_op(OP_ALLOC, map_ptr(p), size);
+            break;
+        case OP_FREE:
+            if (old)
+                log_op(OP_FREE, release_id(unmap_ptr(old)), 0);
+            break;
+        case OP_REALLOC:
+            if (old == NULL) {
+                if (p)
+                    log_op(OP_ALLOC, map_ptr(p), size);
+            } else if (size == 0) {
+                log_op(OP_FREE, release_id(unmap_ptr(old)), 0);
+            } else if (p) {
+                /* the block keeps its id wherever it moved */
+                if ((id = unmap_ptr(old)) == UINT32_MAX)
+                    log_op(OP_ALLOC, map_ptr(p), size);
+                else
+                    log_op(OP_REALLOC, bind_ptr(p, id), size);
+            }
+            break;
+        }
+    }
+}
+
+/* Buffered write of the finished trace; stdio might call malloc */
+static char out_buf[1 << 16];
+static size_t out_len;
+static int out_fd;
+
+static void out_flush(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < out_len) {
+        if ((n = write(out_fd, out_buf + done, out_len - done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    out_len = 0;
+}
+
+static void out_line(const char *fmt, unsigned a, unsigned b, unsigned c)
+{
+    if (out_len + 64 > sizeof(out_buf))
+        out_flush();
+    out_len += snprintf(out_buf + out_len, 64, fmt, a, b, c);
+}
+
+/*
+ * mtrace_write - Write the log as a .rep: weight, num_ids, num_ops,
+ *     ignore_ranges, then one line per op.
+ */
+static void mtrace_write(void)
+{
+    char name[PATH_MAX];
+    const char *env = getenv("MTRACE_OUT");
+    size_t i;
+
+    if (env && getpid() == first_pid)
+        snprintf(name, sizeof(name), "%s", env);
+    else if (env)
+        snprintf(name, sizeof(name), "%s.%d", env, (int)getpid());
+    else
+        snprintf(name, sizeof(name), "mtrace.%d.rep", (int)getpid());
+
+    if ((out_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    out_line("%u\n%u\n%u\n0\n", 0, next_id, (unsigned)num_ops);
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].type == OP_FREE)
+            out_line("f %u\n", ops[i].id, 0, 0);
+        else
+            out_line("%c %u %u\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    out_flush();
+    close(out_fd);
+}
+
+/* In a forked child, start over with an empty log */
+static void mtrace_atfork_child(void)
+{
+    pthread_mutex_init(&lock, NULL);
+    num_ops = 0;
+    num_slots_used = 0;
+    num_free_ids = 0;
+    next_id = 0;
+    if (slots)
+        memset(slots, 0, (slots_mask + 1) * sizeof(slot_t));
+}
+
+static void mtrace_atfork_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void mtrace_atfork_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+__attribute__((constructor))
+static void mtrace_init(void)
+{
+    if (real_malloc)
+        return;
+    busy = 1;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving = 0;
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free) {
+        say("mtrace: cannot find the real malloc\n");
+        _exit(1);
+    }
+    pthread_atfork(mtrace_atfork_prepare, mtrace_atfork_parent,
+                   mtrace_atfork_child);
+    first_pid = getpid();
+    recording = 1;
+    busy = 0;
+}
+
+__attribute__((destructor))
+static void mtrace_fini(void)
+{
+    busy = 1;
+    pthread_mutex_lock(&lock);
+    if (recording) {
+        recording = 0;
+        mtrace_write();
+    }
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+}
+
+static int from_boot_heap(void *p)
+{
+    return (char *)p >= boot_heap && (char *)p < boot_heap + sizeof(boot_heap);
+}
+
+/*
+ * The interposed functions. busy keeps a request that our own code
+ * (or libc, on our behalf) makes from being logged.
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!real_malloc)
+        mtrace_init();
+    if (busy)
+        return real_malloc(size);
+    busy = 1;
+    p = real_malloc(size);
+    pthread_mutex_lock(&lock);
+    record(OP_ALLOC, NULL, p, size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (resolving) {
+        size_t n = (nmemb * size + 15) & ~(size_t)15;
+        if (boot_used + n > sizeof(boot_heap))
+            return NULL;
+        p = boot_heap + boot_used;
+        boot_used += n;
+        return p;          /* static storage is already zero */
+    }
+    if (!real_calloc)
+        mtrace_init();
+    if (busy)
+        return real_calloc(nmemb, size);
+    busy = 1;
+    p = real_calloc(nmemb, size);
+    pthread_mutex_lock(&lock);
+    record(OP_ALLOC, NULL, p, nmemb * size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    void *p;
+
+    if (!real_realloc)
+        mtrace_init();
+    if (from_boot_heap(old)) {
+        if ((p = real_malloc(size)) != NULL)
+            memcpy(p, old, size < sizeof(boot_heap) ? size : sizeof(boot_heap));
+        return p;
+    }
+    if (busy)
+        return real_realloc(old, size);
+    busy = 1;
+    /* hold the lock across the call, so that no other thread can be
+       given the old address and log it before we unmap it */
+    pthread_mutex_lock(&lock);
+    p = real_realloc(old, size);
+    record(OP_REALLOC, old, p, size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (from_boot_heap(ptr))
+        return;
+    if (!real_free)
+        mtrace_init();
+    if (busy) {
+        real_free(ptr);
+        return;
+    }
+    busy = 1;
+    /* forget the pointer first, before another thread can get it back */
+    pthread_mutex_lock(&lock);
+    record(OP_FREE, ptr, NULL, 0);
+    pthread_mutex_unlock(&lock);
+    real_free(ptr);
+    busy = 0;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (!real_memalign)
+        mtrace_init();
+    if (busy)
+        return real_memalign(align, size);
+    busy = 1;
+    p = real_memalign(align, size);
+    pthread_mutex_lock(&lock);
+    record(OP_ALLOC, NULL, p, size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
+
+int posix_memalign(void **pp, size_t align, size_t size)
+{
+    int r;
+
+    if (!real_posix_memalign)
+        mtrace_init();
+    if (busy)
+        return real_posix_memalign(pp, align, size);
+    busy = 1;
+    r = real_posix_memalign(pp, align, size);
+    pthread_mutex_lock(&lock);
+    record(OP_ALLOC, NULL, r == 0 ? *pp : NULL, size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return r;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (!real_aligned_alloc)
+        mtrace_init();
+    if (busy)
+        return real_aligned_alloc(align, size);
+    busy = 1;
+    p = real_aligned_alloc(align, size);
+    pthread_mutex_lock(&lock);
+    record(OP_ALLOC, NULL, p, size);
+    pthread_mutex_unlock(&lock);
+    busy = 0;
+    return p;
+}
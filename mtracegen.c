@@ -0,0 +1,477 @@
+/*
+ * mtracegen.c - Generate synthetic .rep traces from parameterized
+ *     request-size, lifetime and realloc-growth distributions.
+ *
+ * usage: mtracegen [options] -o <out.rep>
+ *
+ * The same options and seed always give the same trace. Ops are
+ * written as they are generated, and ids of freed blocks are reused,
+ * so memory use follows the live set rather than the trace length.
+ * The header is written padded and filled in at the end, once the op
+ * and id counts are known.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAX_SIZE    (1 << 30)   /* no request is larger than this */
+#define HDR_WIDTH   12          /* digits reserved for each header field */
+
+/* Request-size distributions */
+enum { SZ_UNIFORM, SZ_POWER, SZ_BIMODAL };
+
+/* Lifetime models */
+enum { LT_EXP, LT_PHASE, LT_LIFO, LT_FIFO };
+
+/* Realloc growth */
+enum { GR_MUL, GR_ADD };
+
+static struct {
+    int kind;
+    double a, b, c, d;
+} size_dist = { SZ_POWER, 16, 4096, 1.5, 0 };
+
+static struct {
+    int kind;
+    double param;              /* mean lifetime, phase length, or target live */
+} life = { LT_EXP, 1000 };
+
+static struct {
+    int kind;
+    double param;
+} growth = { GR_MUL, 1.5 };
+
+static long long target_ops = 100000;
+static double realloc_frac = 0;
+static long live_cap = 0;        /* 0: no cap on live blocks */
+static int weight = 0;
+static int threads = 1;          /* ops go to random threads if > 1 */
+static long barrier_every = 0;   /* ops between barriers; 0 for none */
+static uint64_t rng_state;
+
+/* Per-id state. An id is live while pos[id] >= 0. */
+static uint32_t *sizes;
+static long *pos;                /* index of the id in live[] */
+static long *live;               /* ids of the live blocks, in no order */
+static long num_live;
+
+/* Min-heap of (death time, id) for the exp and phase models */
+typedef struct {
+    uint64_t death;
+    long id;
+} death_t;
+static death_t *heap;
+static long heap_len;
+
+/* Stack (LIFO) or ring queue (FIFO) of ids for the ordered models */
+static long *order;
+static long order_head, order_len;
+
+/* Ids free for reuse, and the next never-used id */
+static long *free_ids;
+static long num_free_ids, next_id;
+
+static long cap;                 /* capacity of all the per-id arrays */
+
+static long long num_ops, num_allocs, num_reallocs, num_frees;
+static uint64_t live_bytes, peak_live_bytes;
+static long peak_live;
+static FILE *out;
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mtracegen: %s %s\n", msg, arg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mtracegen [options] -o <out.rep>\n");
+    fprintf(stderr, "  -n <ops>          Approximate number of ops (default 100000)\n");
+    fprintf(stderr, "  -s <seed>         Random seed (default 1)\n");
+    fprintf(stderr, "  -z <dist>         Request sizes, one of\n");
+    fprintf(stderr, "                      uniform:<min>:<max>\n");
+    fprintf(stderr, "                      power:<min>:<max>:<alpha>   (default power:16:4096:1.5)\n");
+    fprintf(stderr, "                      bimodal:<small>:<large>:<p>  p = fraction large\n");
+    fprintf(stderr, "  -t <lifetime>     Block lifetimes, one of\n");
+    fprintf(stderr, "                      exp:<mean>     exponential, in allocations (default exp:1000)\n");
+    fprintf(stderr, "                      phase:<len>    all blocks of a phase die at its end\n");
+    fprintf(stderr, "                      lifo:<live>    free newest first, hovering around <live> blocks\n");
+    fprintf(stderr, "                      fifo:<live>    free oldest first, hovering around <live> blocks\n");
+    fprintf(stderr, "  -r <frac>         Fraction of ops that realloc a random live block (default 0)\n");
+    fprintf(stderr, "  -g <growth>       Realloc growth: mul:<factor> (default mul:1.5) or add:<bytes>\n");
+    fprintf(stderr, "  -l <blocks>       Never hold more than this many live blocks\n");
+    fprintf(stderr, "  -w <weight>       Weight written to the trace header (default 0)\n");
+    fprintf(stderr, "  -p <n>[:<every>]  Give each op to a random one of n threads, with a\n");
+    fprintf(stderr, "                      barrier every <every> ops\n");
+    exit(1);
+}
+
+/*
+ * rand64 - xorshift64*, seeded through splitmix64 so that small seeds
+ *     still give well mixed streams
+ */
+static uint64_t rand64(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void seed_rng(uint64_t seed)
+{
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    rng_state = (z ^ (z >> 31)) | 1;
+}
+
+/* Uniform double in (0, 1] */
+static double rand_unit(void)
+{
+    return ((rand64() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * draw_size - One request size from size_dist. The power law is
+ *     truncated to [min, max] and sampled by inverting its CDF.
+ */
+static uint32_t draw_size(void)
+{
+    double lo = size_dist.a, hi = size_dist.b, s;
+    double u = rand_unit();
+
+    switch (size_dist.kind) {
+    case SZ_UNIFORM:
+        s = lo + floor(u * (hi - lo + 1));
+        break;
+    case SZ_POWER: {
+        double e = 1 - size_dist.c;
+        if (fabs(e) < 1e-9)
+            s = lo * pow(hi / lo, u);
+        else
+            s = pow(pow(lo, e) + u * (pow(hi, e) - pow(lo, e)), 1 / e);
+        break;
+    }
+    default: /* SZ_BIMODAL */
+        s = u <= size_dist.c ? hi : lo;
+        break;
+    }
+    if (s < 1)
+        s = 1;
+    if (s > MAX_SIZE)
+        s = MAX_SIZE;
+    return (uint32_t)s;
+}
+
+/* Grow a block's size for a realloc */
+static uint32_t grow(uint32_t size)
+{
+    double s = growth.kind == GR_MUL ? size * growth.param : size + growth.param;
+    if (s < 1)
+        s = 1;
+    return s > MAX_SIZE ? MAX_SIZE : (uint32_t)s;
+}
+
+/* Make room for at least n ids in every per-id array */
+static void reserve(long n)
+{
+    long i, old = cap;
+
+    if (n <= cap)
+        return;
+    cap = cap ? 2 * cap : 4096;
+    if (cap < n)
+        cap = n;
+    if ((sizes = realloc(sizes, cap * sizeof(*sizes))) == NULL ||
+        (pos = realloc(pos, cap * sizeof(*pos))) == NULL ||
+        (live = realloc(live, cap * sizeof(*live))) == NULL ||
+        (heap = realloc(heap, cap * sizeof(*heap))) == NULL ||
+        (free_ids = realloc(free_ids, cap * sizeof(*free_ids))) == NULL)
+        die("out of memory", "");
+    for (i = old; i < cap; i++)
+        pos[i] = -1;
+
+    /* The FIFO ring has to be unwrapped into the bigger array */
+    {
+        long *o = malloc(cap * sizeof(*o));
+        if (o == NULL)
+            die("out of memory", "");
+        for (i = 0; i < order_len; i++)
+            o[i] = order[(order_head + i) % old];
+        free(order);
+        order = o;
+        order_head = 0;
+    }
+}
+
+static void heap_push(uint64_t death, long id)
+{
+    long i = heap_len++;
+
+    while (i > 0 && heap[(i - 1) / 2].death > death) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].death = death;
+    heap[i].id = id;
+}
+
+static long heap_pop(void)
+{
+    long id = heap[0].id, i = 0, c;
+    death_t last = heap[--heap_len];
+
+    while ((c = 2 * i + 1) < heap_len) {
+        if (c + 1 < heap_len && heap[c + 1].death < heap[c].death)
+            c++;
+        if (heap[c].death >= last.death)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return id;
+}
+
+/* Take the id the lifetime model says dies next */
+static long next_victim(void)
+{
+    long id;
+
+    switch (life.kind) {
+    case LT_LIFO:
+        return order[--order_len];
+    case LT_FIFO:
+        id = order[order_head];
+        order_head = (order_head + 1) % cap;
+        order_len--;
+        return id;
+    default:
+        return heap_pop();
+    }
+}
+
+/*
+ * emit_thread - Prefix the next op with a random thread, so that a
+ *     block is usually freed by another thread than allocated it
+ */
+static void emit_thread(void)
+{
+    if (threads > 1)
+        fprintf(out, "@%d ", (int)(rand64() % threads));
+}
+
+static void emit_alloc(uint64_t now)
+{
+    long id = num_free_ids ? free_ids[--num_free_ids] : next_id++;
+    uint64_t death;
+
+    reserve(next_id);
+    sizes[id] = draw_size();
+    pos[id] = num_live;
+    live[num_live++] = id;
+
+    switch (life.kind) {
+    case LT_EXP:
+        death = now + 1 + (uint64_t)(-life.param * log(rand_unit()));
+        heap_push(death, id);
+        break;
+    case LT_PHASE:
+        death = (now / (uint64_t)life.param + 1) * (uint64_t)life.param;
+        heap_push(death, id);
+        break;
+    default:
+        order[(order_head + order_len++) % cap] = id;
+        break;
+    }
+
+    emit_thread();
+    fprintf(out, "a %ld %u\n", id, sizes[id]);
+    num_allocs++;
+    live_bytes += sizes[id];
+    if (live_bytes > peak_live_bytes)
+        peak_live_bytes = live_bytes;
+    if (num_live > peak_live)
+        peak_live = num_live;
+}
+
+static void emit_free(long id)
+{
+    long last = live[--num_live];
+
+    live[pos[id]] = last;
+    pos[last] = pos[id];
+    pos[id] = -1;
+    free_ids[num_free_ids++] = id;
+
+    emit_thread();
+    fprintf(out, "f %ld\n", id);
+    num_frees++;
+    live_bytes -= sizes[id];
+}
+
+static void emit_realloc(void)
+{
+    long id = live[rand64() % num_live];
+    uint32_t size = grow(sizes[id]);
+
+    emit_thread();
+    fprintf(out, "r %ld %u\n", id, size);
+    num_reallocs++;
+    live_bytes += size;
+    live_bytes -= sizes[id];
+    sizes[id] = size;
+    if (live_bytes > peak_live_bytes)
+        peak_live_bytes = live_bytes;
+}
+
+/*
+ * time_to_free - Whether the next op should be a free. The exp and
+ *     phase models free whatever is due; the ordered models drift
+ *     around their target live count by freeing with probability
+ *     live / (2 * target).
+ */
+static int time_to_free(uint64_t now)
+{
+    if (num_live == 0)
+        return 0;
+    if (live_cap && num_live >= live_cap)
+        return 1;
+    if (life.kind == LT_EXP || life.kind == LT_PHASE)
+        return heap[0].death <= now;
+    return rand_unit() * 2 * life.param < num_live;
+}
+
+static void write_header(long num_ids)
+{
+    if (fseek(out, 0, SEEK_SET) != 0)
+        die("cannot seek in the output", "");
+    fprintf(out, "%-*d\n%-*ld\n%-*lld\n%-*d\n", HDR_WIDTH, weight,
+            HDR_WIDTH, num_ids, HDR_WIDTH, num_ops, HDR_WIDTH, 0);
+}
+
+int main(int argc, char **argv)
+{
+    char *outname = NULL, kind[16];
+    uint64_t now = 0;              /* allocations so far */
+    int c;
+
+    seed_rng(1);
+    while ((c = getopt(argc, argv, "n:s:z:t:r:g:l:w:p:o:h")) != EOF) {
+        switch (c) {
+        case 'n':
+            target_ops = atoll(optarg);
+            break;
+        case 's':
+            seed_rng(strtoull(optarg, NULL, 0));
+            break;
+        case 'z': {
+            /* uniform takes two parameters, the others all three */
+            int n = sscanf(optarg, "%15[a-z]:%lf:%lf:%lf", kind, &size_dist.a,
+                           &size_dist.b, &size_dist.c);
+            if (n < 1)
+                die("bad size distribution", optarg);
+            if (!strcmp(kind, "uniform"))
+                size_dist.kind = SZ_UNIFORM;
+            else if (!strcmp(kind, "power"))
+                size_dist.kind = SZ_POWER;
+            else if (!strcmp(kind, "bimodal"))
+                size_dist.kind = SZ_BIMODAL;
+            else
+                die("unknown size distribution", optarg);
+            if (n != (size_dist.kind == SZ_UNIFORM ? 3 : 4))
+                die("wrong number of parameters in", optarg);
+            if (size_dist.a < 1 || size_dist.b < size_dist.a)
+                die("bad size range in", optarg);
+            if (size_dist.kind == SZ_BIMODAL &&
+                !(size_dist.c >= 0 && size_dist.c <= 1))
+                die("bimodal fraction must be in [0,1] in", optarg);
+            break;
+        }
+        case 't':
+            if (sscanf(optarg, "%15[a-z]:%lf", kind, &life.param) != 2 ||
+                life.param < 1)
+                die("bad lifetime model", optarg);
+            if (!strcmp(kind, "exp"))
+                life.kind = LT_EXP;
+            else if (!strcmp(kind, "phase"))
+                life.kind = LT_PHASE;
+            else if (!strcmp(kind, "lifo"))
+                life.kind = LT_LIFO;
+            else if (!strcmp(kind, "fifo"))
+                life.kind = LT_FIFO;
+            else
+                die("unknown lifetime model", optarg);
+            break;
+        case 'r':
+            realloc_frac = atof(optarg);
+            break;
+        case 'g':
+            if (sscanf(optarg, "%15[a-z]:%lf", kind, &growth.param) != 2)
+                die("bad realloc growth", optarg);
+            if (!strcmp(kind, "mul"))
+                growth.kind = GR_MUL;
+            else if (!strcmp(kind, "add"))
+                growth.kind = GR_ADD;
+            else
+                die("unknown realloc growth", optarg);
+            break;
+        case 'l':
+            live_cap = atol(optarg);
+            break;
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        case 'p':
+            if (sscanf(optarg, "%d:%ld", &threads, &barrier_every) < 1 ||
+                threads < 1 || threads > 64 || barrier_every < 0)
+                die("bad thread count", optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (outname == NULL || target_ops < 1)
+        usage();
+
+    if ((out = fopen(outname, "w")) == NULL)
+        die("could not create", outname);
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    write_header(0);
+    reserve(1);
+
+    /* Leave enough of the op budget to free everything at the end */
+    while (num_ops + num_live + 2 <= target_ops) {
+        if (time_to_free(now))
+            emit_free(next_victim());
+        else if (num_live > 0 && rand_unit() < realloc_frac)
+            emit_realloc();
+        else
+            emit_alloc(now++);
+        num_ops++;
+        if (barrier_every && num_ops % barrier_every == 0)
+            fprintf(out, "b\n");
+    }
+    while (num_live > 0) {
+        emit_free(next_victim());
+        num_ops++;
+    }
+
+    write_header(next_id);
+    if (fclose(out) != 0)
+        die("error writing", outname);
+
+    fprintf(stderr, "%s: %lld ops (%lld allocs, %lld reallocs, %lld frees), "
+            "%ld ids, peak %ld blocks / %llu bytes live\n", outname, num_ops,
+            num_allocs, num_reallocs, num_frees, next_id, peak_live,
+            (unsigned long long)peak_live_bytes);
+    return 0;
+}
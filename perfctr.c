@@ -0,0 +1,118 @@
+/*
+ * perfctr.c - hardware performance counters via perf_event_open,
+ *     see perfctr.h
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+static const char *names[PC_NUM] = {
+    "instr", "cycles", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} events[PC_NUM] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int fds[PC_NUM] = { -1, -1, -1, -1, -1, -1 };
+static pid_t owner = 0;          /* process the fds count for */
+
+/*
+ * perfctr_init - Each counter gets its own fd rather than one group,
+ *     so that an event the CPU lacks does not take the others with it.
+ *     If they cannot all be scheduled at once, the kernel multiplexes
+ *     them, and perfctr_stop scales the counts by enabled/running time.
+ */
+int perfctr_init(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    /* a forked child inherits fds that still count for its parent */
+    if (owner != getpid()) {
+        for (i = 0; i < PC_NUM; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+            fds[i] = -1;
+        }
+        owner = getpid();
+    }
+
+    for (i = 0; i < PC_NUM; i++) {
+        if (fds[i] >= 0) {
+            n++;
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] >= 0)
+            n++;
+    }
+    return n;
+}
+
+const char *perfctr_name(int i)
+{
+    return names[i];
+}
+
+/*
+ * perfctr_start - Zero and start all counters
+ */
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/*
+ * perfctr_stop - Stop all counters and read them into *pc
+ */
+void perfctr_stop(perfctr_t *pc)
+{
+    unsigned long long v[3];  /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        if (fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PC_NUM; i++) {
+        pc->valid[i] = 0;
+        pc->count[i] = 0;
+        if (fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+            continue;
+        pc->valid[i] = 1;
+        pc->count[i] = (double)v[0] * ((double)v[1] / v[2]);
+    }
+}
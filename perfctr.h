@@ -0,0 +1,36 @@
+/*
+ * perfctr.h - hardware performance counters via perf_event_open
+ *
+ * The counters count user-mode events for this process only. Any
+ * counter the kernel or the CPU will not give us (no PMU in a VM, or
+ * perf_event_paranoid too high) is simply left out.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+#define PC_INSTR     0
+#define PC_CYCLES    1
+#define PC_L1D_MISS  2
+#define PC_LLC_MISS  3
+#define PC_DTLB_MISS 4
+#define PC_BR_MISS   5
+#define PC_NUM       6
+
+typedef struct {
+    int valid[PC_NUM];           /* was this counter available? */
+    double count[PC_NUM];        /* scaled up if the counter was multiplexed */
+} perfctr_t;
+
+/* Open the counters; returns how many are available, 0 if none */
+int perfctr_init(void);
+
+/* Short name of counter i, for table headings */
+const char *perfctr_name(int i);
+
+/* Zero and start all counters */
+void perfctr_start(void);
+
+/* Stop all counters and read them into *pc */
+void perfctr_stop(perfctr_t *pc);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,141 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the compact binary trace
+ *     format read by mdriver (see bintrace.h).
+ *
+ * usage: rep2bin <in.rep> <out>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bintrace.h"
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "rep2bin: %s %s\n", msg, arg);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    bintrace_hdr_t hdr;
+    int weight, num_ids, num_ops, ignore_ranges;
+    char type[1024];
+    unsigned char *buf;
+    size_t len = 0;
+    size_t *sizes;            /* payload size of each live block, by id */
+    uint64_t live_bytes = 0;
+    uint32_t live_blocks = 0;
+    int prev_index = 0;
+    int op_index = 0;
+    unsigned size = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: rep2bin <in.rep> <out>\n");
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+        die("could not open", argv[1]);
+
+    if (fscanf(in, "%d %d %d %d", &weight, &num_ids, &num_ops,
+               &ignore_ranges) != 4)
+        die("bad trace header in", argv[1]);
+    if (num_ids < 0 || num_ops < 0)
+        die("bad trace header in", argv[1]);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BT_MAGIC, sizeof(hdr.magic));
+    hdr.version = BT_VERSION;
+    hdr.weight = weight;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.ignore_ranges = ignore_ranges;
+
+    if ((buf = malloc((size_t)num_ops * BT_MAX_OP_BYTES + 1)) == NULL ||
+        (sizes = calloc(num_ids + 1, sizeof(size_t))) == NULL)
+        die("out of memory converting", argv[1]);
+
+    while (op_index < num_ops && fscanf(in, "%1023s", type) == 1) {
+        int index;
+        int t;
+
+        /* As in mdriver's read_trace, a missing size repeats the
+           previous one */
+        switch (type[0]) {
+        case 'a':
+            t = BT_ALLOC;
+            if (fscanf(in, "%d %u", &index, &size) < 1)
+                die("truncated alloc in", argv[1]);
+            break;
+        case 'r':
+            t = BT_REALLOC;
+            if (fscanf(in, "%d %u", &index, &size) < 1)
+                die("truncated realloc in", argv[1]);
+            break;
+        case 'f':
+            t = BT_FREE;
+            if (fscanf(in, "%d", &index) != 1)
+                die("truncated free in", argv[1]);
+            break;
+        default:
+            if (type[0] == '@' || type[0] == 'b')
+                die("binary traces have no threads or barriers; cannot convert",
+                    argv[1]);
+            die("bogus op type in", argv[1]);
+        }
+        /* only free takes -1, for free(NULL) */
+        if (index < (t == BT_FREE ? -1 : 0) || index >= num_ids)
+            die("op index out of range in", argv[1]);
+
+        /* Track the live set, the same way eval_mm_util does */
+        switch (t) {
+        case BT_ALLOC:
+            hdr.num_allocs++;
+            live_bytes += size;
+            live_blocks++;
+            sizes[index] = size;
+            break;
+        case BT_REALLOC:
+            hdr.num_reallocs++;
+            live_bytes += size;
+            live_bytes -= sizes[index];
+            sizes[index] = size;
+            break;
+        case BT_FREE:
+            hdr.num_frees++;
+            if (index >= 0) {
+                live_bytes -= sizes[index];
+                live_blocks--;
+                sizes[index] = 0;
+            }
+            break;
+        }
+        if (t != BT_FREE) {
+            hdr.total_alloc_bytes += size;
+            if (size > hdr.max_size)
+                hdr.max_size = size;
+        }
+        if (live_bytes > hdr.peak_live_bytes)
+            hdr.peak_live_bytes = live_bytes;
+        if (live_blocks > hdr.peak_live_blocks)
+            hdr.peak_live_blocks = live_blocks;
+
+        len += bt_encode_op(buf + len, t, index, size, &prev_index);
+        op_index++;
+    }
+    fclose(in);
+    if (op_index != num_ops)
+        die("fewer ops than the header says in", argv[1]);
+    hdr.ops_bytes = len;
+
+    if ((out = fopen(argv[2], "wb")) == NULL)
+        die("could not create", argv[2]);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        fwrite(buf, 1, len, out) != len || fclose(out) != 0)
+        die("error writing", argv[2]);
+
+    free(buf);
+    free(sizes);
+    return 0;
+}